@@ -0,0 +1,259 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "Charts.h"
+#include "Face.h"
+#include "FacesData.h"
+#include "Matrix44F.h"
+#include "Point2F.h"
+#include "Point3F.h"
+#include "ThreadPool.h"
+#include "Vector3F.h"
+#include "mesh_generator.h"
+#include "project.h"
+#include "unwrap.h"
+#include "unwrap_stages.h"
+#include "xatlas.h"
+
+namespace
+{
+
+/*!
+ * @return A mesh of the given shape and number of faces, in which each face has its own vertices like meshes loaded from STL files. Big meshes are slow
+ *         to generate, so the last one is kept for the next benchmark.
+ */
+const mesh_generator::GeneratedMesh& getMesh(const size_t faces_count, const mesh_generator::Shape shape = mesh_generator::Shape::Sphere)
+{
+    static mesh_generator::GeneratorOptions cached_options{ .faces_count = 0 };
+    static mesh_generator::GeneratedMesh cached_mesh;
+    if (faces_count != cached_options.faces_count || shape != cached_options.shape)
+    {
+        cached_options = mesh_generator::GeneratorOptions{ .shape = shape, .faces_count = faces_count, .soup = true, .with_connectivity = true };
+        cached_mesh = mesh_generator::generateMesh(cached_options);
+    }
+
+    return cached_mesh;
+}
+
+ThreadPool& getThreadPool()
+{
+    static ThreadPool thread_pool;
+    return thread_pool;
+}
+
+void setFacesProcessed(benchmark::State& state, const mesh_generator::GeneratedMesh& mesh)
+{
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(mesh.faces.size()));
+    state.counters["faces"] = static_cast<double>(mesh.faces.size());
+}
+
+void BM_FacesDataFill(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    FacesData faces_data;
+    for (auto _ : state)
+    {
+        faces_data.fill(mesh.vertices, mesh.faces, getThreadPool());
+        benchmark::DoNotOptimize(faces_data.face_index.data());
+    }
+    setFacesProcessed(state, mesh);
+}
+
+void BM_CalculateProjectionNormals(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    FacesData faces_data;
+    faces_data.fill(mesh.vertices, mesh.faces, getThreadPool());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(calculateProjectionNormals(faces_data, getThreadPool()));
+    }
+    setFacesProcessed(state, mesh);
+}
+
+void BM_MakeCharts(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    std::vector<Point2F> uv_coords(mesh.vertices.size());
+    UnwrapScratch scratch;
+    size_t charts_count = 0;
+    for (auto _ : state)
+    {
+        charts_count = makeCharts(mesh.vertices, mesh.faces, uv_coords, 0, getThreadPool(), scratch).size();
+    }
+    setFacesProcessed(state, mesh);
+    state.counters["charts"] = static_cast<double>(charts_count);
+}
+
+void BM_GroupSimilarVertices(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    UnwrapScratch scratch;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(groupSimilarVertices(mesh.faces, mesh.vertices, 0.0f, getThreadPool(), scratch).data());
+    }
+    setFacesProcessed(state, mesh);
+}
+
+void BM_SplitNonLinkedFacesCharts(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    std::vector<Point2F> uv_coords(mesh.vertices.size());
+    UnwrapScratch scratch;
+    const Charts charts = makeCharts(mesh.vertices, mesh.faces, uv_coords, 0, getThreadPool(), scratch);
+    const std::vector<Face> welded_faces = groupSimilarVertices(mesh.faces, mesh.vertices, 0.0f, getThreadPool(), scratch);
+    size_t charts_count = 0;
+    for (auto _ : state)
+    {
+        charts_count = splitNonLinkedFacesCharts(charts, welded_faces, getThreadPool()).size();
+    }
+    setFacesProcessed(state, mesh);
+    state.counters["charts"] = static_cast<double>(charts_count);
+}
+
+void BM_PackCharts(benchmark::State& state)
+{
+    const bool skyline_packing = state.range(1) != 0;
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    std::vector<Point2F> raw_uv_coords(mesh.vertices.size());
+    UnwrapScratch scratch;
+    Charts charts = makeCharts(mesh.vertices, mesh.faces, raw_uv_coords, 0, getThreadPool(), scratch);
+    const std::vector<Face>& welded_faces = groupSimilarVertices(mesh.faces, mesh.vertices, 0.0f, getThreadPool(), scratch);
+    charts = splitNonLinkedFacesCharts(charts, welded_faces, getThreadPool());
+
+    xatlas::Atlas* atlas = xatlas::Create(&getThreadPool());
+    std::vector<Point2F> uv_coords;
+    UnwrapStats stats;
+    for (auto _ : state)
+    {
+        // Packing modifies the UV coordinates, so restore the raw ones
+        state.PauseTiming();
+        uv_coords = raw_uv_coords;
+        state.ResumeTiming();
+
+        uint32_t texture_width;
+        uint32_t texture_height;
+        packCharts(mesh.vertices, mesh.faces, charts, uv_coords, texture_width, texture_height, skyline_packing, atlas, stats);
+    }
+    xatlas::Destroy(atlas);
+
+    setFacesProcessed(state, mesh);
+    state.counters["charts"] = static_cast<double>(charts.size());
+    state.counters["utilization"] = stats.atlas_utilization;
+}
+
+void BM_SmartUnwrap(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0), static_cast<mesh_generator::Shape>(state.range(1)));
+    UnwrapContext context(getThreadPool());
+    std::vector<Point2F> uv_coords(mesh.vertices.size());
+    UnwrapStats stats;
+    for (auto _ : state)
+    {
+        uint32_t texture_width;
+        uint32_t texture_height;
+        context.smartUnwrap(mesh.vertices, mesh.faces, uv_coords, texture_width, texture_height, UnwrapOptions(), &stats);
+    }
+
+    setFacesProcessed(state, mesh);
+    state.counters["charts"] = static_cast<double>(stats.charts_count_after_split);
+    state.counters["dropped_faces"] = static_cast<double>(stats.dropped_faces_count);
+    state.counters["utilization"] = stats.atlas_utilization;
+}
+
+void BM_Project(benchmark::State& state)
+{
+    const mesh_generator::GeneratedMesh& mesh = getMesh(state.range(0));
+    std::vector<Point3F> vertices = mesh.vertices;
+    std::vector<Face> faces = mesh.faces;
+    std::vector<Point2F> uv_coords(mesh.vertices.size());
+    uint32_t texture_width;
+    uint32_t texture_height;
+    UnwrapContext context(getThreadPool());
+    context.smartUnwrap(vertices, faces, uv_coords, texture_width, texture_height);
+
+    std::vector<FaceSigned> faces_connectivity = mesh.faces_connectivity;
+
+    // Look at the sphere from the front with an orthographic camera, and start painting from the face that is the closest to the camera
+    constexpr float identity[4][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+    const Matrix44F camera_projection_matrix(identity);
+    const Vector3F camera_normal(0, 0, 1);
+    constexpr uint32_t viewport_size = 1000;
+
+    uint32_t start_face = 0;
+    float start_face_depth = std::numeric_limits<float>::lowest();
+    for (size_t face_index = 0; face_index < faces.size(); ++face_index)
+    {
+        const float depth = vertices[faces[face_index].i1].z() + vertices[faces[face_index].i2].z() + vertices[faces[face_index].i3].z();
+        if (depth > start_face_depth)
+        {
+            start_face = static_cast<uint32_t>(face_index);
+            start_face_depth = depth;
+        }
+    }
+
+    // Paint a square stroke covering about a tenth of the sphere width
+    const Point3F& start_point = vertices[faces[start_face].i1];
+    const Point2F stroke_center{ .x = start_point.x() * viewport_size / 2.0f, .y = start_point.y() * viewport_size / 2.0f };
+    constexpr float stroke_half_size = viewport_size / 20.0f;
+    std::vector<Point2F> stroke_polygon = { Point2F{ .x = stroke_center.x - stroke_half_size, .y = stroke_center.y - stroke_half_size },
+                                            Point2F{ .x = stroke_center.x + stroke_half_size, .y = stroke_center.y - stroke_half_size },
+                                            Point2F{ .x = stroke_center.x + stroke_half_size, .y = stroke_center.y + stroke_half_size },
+                                            Point2F{ .x = stroke_center.x - stroke_half_size, .y = stroke_center.y + stroke_half_size } };
+
+    size_t polygons_count = 0;
+    for (auto _ : state)
+    {
+        polygons_count = doProject(
+                             stroke_polygon,
+                             vertices,
+                             faces,
+                             uv_coords,
+                             faces_connectivity,
+                             texture_width,
+                             texture_height,
+                             camera_projection_matrix,
+                             false,
+                             viewport_size,
+                             viewport_size,
+                             camera_normal,
+                             start_face,
+                             &getThreadPool())
+                             .size();
+    }
+
+    setFacesProcessed(state, mesh);
+    state.counters["polygons"] = static_cast<double>(polygons_count);
+}
+
+} // namespace
+
+// The cheap stages are measured up to 10M faces, the packing and projection are too slow for that so they stop at 1M faces
+BENCHMARK(BM_FacesDataFill)->RangeMultiplier(10)->Range(1'000, 10'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_CalculateProjectionNormals)->RangeMultiplier(10)->Range(1'000, 10'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_MakeCharts)->RangeMultiplier(10)->Range(1'000, 10'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_GroupSimilarVertices)->RangeMultiplier(10)->Range(1'000, 10'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SplitNonLinkedFacesCharts)->RangeMultiplier(10)->Range(1'000, 10'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_PackCharts)
+    ->ArgsProduct({ benchmark::CreateRange(1'000, 1'000'000, 10), { 0, 1 } })
+    ->ArgNames({ "faces", "skyline" })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_SmartUnwrap)
+    ->ArgsProduct({ benchmark::CreateRange(1'000, 1'000'000, 10),
+                    { static_cast<int64_t>(mesh_generator::Shape::Sphere),
+                      static_cast<int64_t>(mesh_generator::Shape::Terrain),
+                      static_cast<int64_t>(mesh_generator::Shape::Lattice),
+                      static_cast<int64_t>(mesh_generator::Shape::Islands) } })
+    ->ArgNames({ "faces", "shape" })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_Project)->RangeMultiplier(10)->Range(1'000, 1'000'000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -9,6 +9,9 @@
 #include <cstdio>
 #include <cxxopts.hpp>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
 
 #include <spdlog/spdlog.h>
 #include <spdlog/stopwatch.h>
@@ -16,21 +19,77 @@
 #include "Face.h"
 #include "Point2F.h"
 #include "Point3F.h"
+#include "mesh_generator.h"
 #include "unwrap.h"
 
+/*!
+ * Makes a scene containing a generated mesh, so that it can be processed and exported as a loaded one
+ * @param generated_mesh The mesh to be put in the scene
+ * @return The new scene, which should be deleted by the caller
+ */
+static aiScene* makeScene(const mesh_generator::GeneratedMesh& generated_mesh)
+{
+    auto* mesh = new aiMesh();
+    mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+    mesh->mMaterialIndex = 0;
+
+    mesh->mNumVertices = static_cast<unsigned int>(generated_mesh.vertices.size());
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    for (size_t i = 0; i < generated_mesh.vertices.size(); i++)
+    {
+        const Point3F& vertex = generated_mesh.vertices[i];
+        mesh->mVertices[i] = aiVector3D(vertex.x(), vertex.y(), vertex.z());
+    }
+
+    mesh->mNumFaces = static_cast<unsigned int>(generated_mesh.faces.size());
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    for (size_t i = 0; i < generated_mesh.faces.size(); i++)
+    {
+        const Face& face = generated_mesh.faces[i];
+        mesh->mFaces[i].mNumIndices = 3;
+        mesh->mFaces[i].mIndices = new unsigned int[3]{ face.i1, face.i2, face.i3 };
+    }
+
+    auto* scene = new aiScene();
+    scene->mNumMeshes = 1;
+    scene->mMeshes = new aiMesh* [1] { mesh };
+    scene->mNumMaterials = 1;
+    scene->mMaterials = new aiMaterial* [1] { new aiMaterial() };
+    scene->mRootNode = new aiNode();
+    scene->mRootNode->mNumMeshes = 1;
+    scene->mRootNode->mMeshes = new unsigned int[1]{ 0 };
+    return scene;
+}
+
 int main(int argc, char** argv)
 {
     cxxopts::Options options("Uvula", "Test interface for the libuvula library");
     options.add_options()("filepath", "Path of the 3D mesh file to be loaded (OBJ, STL, ...)", cxxopts::value<std::string>())(
         "o,outputfile",
         "Path of the output 3D mesh with UV coordinates (OBJ)",
-        cxxopts::value<std::string>())("d,debug", "Display debug output")("h,help", "Print this help and exit");
+        cxxopts::value<std::string>())(
+        "w,weld-tolerance",
+        "Size of the grid that vertices are snapped to, to be merged when detecting adjacent faces",
+        cxxopts::value<float>()->default_value("0"))(
+        "s,normal-samples",
+        "Maximum number of faces used to estimate the projection normals, 0 to use all faces",
+        cxxopts::value<size_t>()->default_value("0"))(
+        "skyline",
+        "Pack the charts by their bounding rectangles, which is faster for meshes with very many charts")(
+        "g,generate",
+        "Generate a mesh instead of loading a file, which can be sphere, terrain, lattice or islands",
+        cxxopts::value<std::string>())("faces", "Approximate number of faces of the generated mesh", cxxopts::value<size_t>()->default_value("100000"))(
+        "seed",
+        "Seed of the random variations of the generated mesh",
+        cxxopts::value<uint32_t>()->default_value("0"))("soup", "Give each face of the generated mesh its own vertices")("d,debug", "Display debug output")(
+        "h,help",
+        "Print this help and exit");
     options.parse_positional({ "filepath" });
     options.positional_help("<filepath>");
     options.show_positional_help();
 
     cxxopts::ParseResult result = options.parse(argc, argv);
-    if (result.count("help") || ! result.count("filepath"))
+    if (result.count("help") || (! result.count("filepath") && ! result.count("generate")))
     {
         std::cout << options.help() << std::endl;
         return 0;
@@ -41,16 +100,43 @@ int main(int argc, char** argv)
         spdlog::set_level(spdlog::level::debug);
     }
 
-    const std::string file_path = result["filepath"].as<std::string>();
-    spdlog::info("Loading mesh from {}", file_path);
+    const UnwrapOptions unwrap_options{ .vertices_weld_tolerance = result["weld-tolerance"].as<float>(),
+                                        .projection_normals_max_samples = result["normal-samples"].as<size_t>(),
+                                        .skyline_packing = result.count("skyline") > 0 };
 
     Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(file_path, 0);
+    std::unique_ptr<aiScene> generated_scene;
+    const aiScene* scene = nullptr;
+
+    if (result.count("generate"))
+    {
+        const std::string shape_name = result["generate"].as<std::string>();
+        const std::optional<mesh_generator::Shape> shape = mesh_generator::shapeFromName(shape_name);
+        if (! shape)
+        {
+            spdlog::error("Unknown shape to be generated: {}", shape_name);
+            return 1;
+        }
 
-    if (! scene)
+        spdlog::info("Generating {} mesh", shape_name);
+        const mesh_generator::GeneratorOptions generator_options{ .shape = *shape,
+                                                                  .faces_count = result["faces"].as<size_t>(),
+                                                                  .seed = result["seed"].as<uint32_t>(),
+                                                                  .soup = result.count("soup") > 0 };
+        generated_scene.reset(makeScene(mesh_generator::generateMesh(generator_options)));
+        scene = generated_scene.get();
+    }
+    else
     {
-        spdlog::error("Failed to load mesh: {}", importer.GetErrorString());
-        return 1;
+        const std::string file_path = result["filepath"].as<std::string>();
+        spdlog::info("Loading mesh from {}", file_path);
+
+        scene = importer.ReadFile(file_path, 0);
+        if (! scene)
+        {
+            spdlog::error("Failed to load mesh: {}", importer.GetErrorString());
+            return 1;
+        }
     }
 
     if (scene->HasMeshes())
@@ -84,13 +170,9 @@ int main(int argc, char** argv)
             spdlog::info("Processing (unnamed) mesh", mesh->mName.data);
         }
 
-        std::vector<Point3F> vertices;
-        vertices.reserve(mesh->mNumVertices);
-        for (size_t j = 0; j < mesh->mNumVertices; j++)
-        {
-            const aiVector3D vertex = mesh->mVertices[j];
-            vertices.emplace_back(vertex.x, vertex.y, vertex.z);
-        }
+        // Assimp vertices have the same layout as ours, so they can be used directly
+        static_assert(sizeof(aiVector3D) == sizeof(Point3F), "aiVector3D is expected to be made of 3 floats");
+        const std::span<const Point3F> vertices(reinterpret_cast<const Point3F*>(mesh->mVertices), mesh->mNumVertices);
 
         std::vector<Face> indices;
         indices.reserve(mesh->mNumFaces);
@@ -102,14 +184,29 @@ int main(int argc, char** argv)
 
         std::vector<Point2F> uv_coords(mesh->mNumVertices, { 0.0, 0.0 });
         uint32_t texture_width, texture_height;
+        UnwrapStats unwrap_stats;
 
         spdlog::stopwatch timer;
 
         spdlog::info("Start UV unwrapping");
-        if (smartUnwrap(vertices, indices, uv_coords, texture_width, texture_height))
+        if (smartUnwrap(vertices, indices, uv_coords, texture_width, texture_height, unwrap_options, &unwrap_stats))
         {
             spdlog::info("Suggested texture size is {}x{}", texture_width, texture_height);
             spdlog::info("UV unwrapping took {}ms", timer.elapsed_ms().count());
+            spdlog::debug(
+                "Stages took {:.1f}ms (charts), {:.1f}ms (weld), {:.1f}ms (split), {:.1f}ms (set charts), {:.1f}ms (pack)",
+                unwrap_stats.make_charts_duration,
+                unwrap_stats.weld_duration,
+                unwrap_stats.split_charts_duration,
+                unwrap_stats.set_charts_duration,
+                unwrap_stats.pack_charts_duration);
+            spdlog::debug(
+                "{} charts split into {}, {} dropped faces, {:.1f}% atlas utilization, {} bytes of scratch memory",
+                unwrap_stats.charts_count_before_split,
+                unwrap_stats.charts_count_after_split,
+                unwrap_stats.dropped_faces_count,
+                unwrap_stats.atlas_utilization * 100.0f,
+                unwrap_stats.scratch_memory);
 
             if (export_scene)
             {
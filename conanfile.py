@@ -30,6 +30,8 @@ class UvulaConan(ConanFile):
         "enable_extensive_warnings": [True, False],
         "with_python_bindings": [True, False],
         "with_cli": [True, False],
+        "with_benchmarks": [True, False],
+        "with_tests": [True, False],
     }
     default_options = {
         "shared": False,
@@ -37,6 +39,8 @@ class UvulaConan(ConanFile):
         "enable_extensive_warnings": False,
         "with_python_bindings": True,
         "with_cli": False,
+        "with_benchmarks": False,
+        "with_tests": False,
     }
 
     def set_version(self):
@@ -99,6 +103,8 @@ class UvulaConan(ConanFile):
         if self.options.get_safe("with_cli", False):
             self.requires("assimp/5.4.3")
             self.requires("cxxopts/3.3.1")
+        if self.options.get_safe("with_benchmarks", False):
+            self.requires("benchmark/1.9.1")
 
     def build_requirements(self):
         self.test_requires("standardprojectsettings/[>=0.1.0]")
@@ -126,6 +132,8 @@ class UvulaConan(ConanFile):
             tc.variables["PYUVULA_VERSION"] = self.version
 
         tc.variables["WITH_CLI"] = self.options.get_safe("with_cli", False)
+        tc.variables["WITH_BENCHMARKS"] = self.options.get_safe("with_benchmarks", False)
+        tc.variables["WITH_TESTS"] = self.options.get_safe("with_tests", False)
 
         if is_msvc(self):
             tc.variables["USE_MSVC_RUNTIME_LIBRARY_DLL"] = not is_msvc_static_runtime(self)
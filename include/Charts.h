@@ -0,0 +1,34 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/*!
+ * List of charts, each being a list of faces indices. The faces of all the charts are stored one chart after the other in a single buffer, and the
+ * offsets tell where each chart starts, so that the whole list only takes two allocations whatever its number of charts.
+ */
+struct Charts
+{
+    std::vector<uint32_t> faces; // Indices of the faces of all the charts, one chart after the other
+    std::vector<uint32_t> offsets{ 0 }; // Index in faces of the first face of each chart, followed by the total number of faces
+
+    /*!
+     * @return The number of charts
+     */
+    [[nodiscard]] size_t size() const
+    {
+        return offsets.size() - 1;
+    }
+
+    /*!
+     * @return The faces indices of the given chart
+     */
+    [[nodiscard]] std::span<const uint32_t> operator[](const size_t chart) const
+    {
+        return std::span<const uint32_t>(faces.data() + offsets[chart], faces.data() + offsets[chart + 1]);
+    }
+};
@@ -0,0 +1,118 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "Face.h"
+#include "Vector3F.h"
+
+class Point3F;
+class ThreadPool;
+
+/*!
+ * Structure-of-arrays buffer containing the non-degenerate faces of a mesh, with their normal and area, so that they can be processed in batches
+ */
+struct FacesData
+{
+    std::vector<uint32_t> face_index; // Index of the face in the original faces list
+    std::vector<float> normal_x;
+    std::vector<float> normal_y;
+    std::vector<float> normal_z;
+    std::vector<float> area;
+
+    [[nodiscard]] size_t size() const
+    {
+        return face_index.size();
+    }
+
+    [[nodiscard]] Vector3F normal(const size_t index) const
+    {
+        return Vector3F(normal_x[index], normal_y[index], normal_z[index]);
+    }
+
+    /*!
+     * @return The number of bytes allocated by the buffer
+     */
+    [[nodiscard]] size_t memoryUsage() const
+    {
+        return (face_index.capacity() * sizeof(uint32_t)) + ((normal_x.capacity() + normal_y.capacity() + normal_z.capacity() + area.capacity()) * sizeof(float));
+    }
+
+    void swapFaces(const size_t index1, const size_t index2)
+    {
+        std::swap(face_index[index1], face_index[index2]);
+        std::swap(normal_x[index1], normal_x[index2]);
+        std::swap(normal_y[index1], normal_y[index2]);
+        std::swap(normal_z[index1], normal_z[index2]);
+        std::swap(area[index1], area[index2]);
+    }
+
+    void clear()
+    {
+        face_index.clear();
+        normal_x.clear();
+        normal_y.clear();
+        normal_z.clear();
+        area.clear();
+    }
+
+    /*!
+     * Fills the buffer with the normal and area of the given faces, skipping the degenerate ones. The results are bit-identical to what
+     * geometry_utils::triangleNormal() gives, whatever the instructions set used.
+     * @param vertices The list of vertices positions
+     * @param faces The list of faces to be processed
+     * @param thread_pool The threads to run the calculation on
+     */
+    void fill(const std::span<const Point3F>& vertices, const std::span<const Face>& faces, ThreadPool& thread_pool);
+
+    /*!
+     * Finds the normal of the given list that has the best dot product with each face normal. In case of equality, the first normal is selected.
+     * @param normals The list of candidate normals, which should not be empty
+     * @param best_normals Output list of indices of the best normal of each face, which will be resized to the number of faces
+     * @param thread_pool The threads to run the calculation on
+     */
+    void findBestNormals(const std::vector<Vector3F>& normals, std::vector<uint32_t>& best_normals, ThreadPool& thread_pool) const;
+
+    /*!
+     * Finds the faces of a range whose normal is close to the given one. The dot products are bit-identical to what Vector3F::dot() gives, whatever the
+     * instructions set used.
+     * @param normal The normal to compare the faces with
+     * @param min_dot The dot product above which a face is close to the normal
+     * @param begin The index of the first face of the range
+     * @param end The index after the last face of the range
+     * @param close_faces Output list telling whether each face of the range is close, which will be resized to the size of the range
+     * @param thread_pool The threads to run the calculation on
+     */
+    void findCloseFaces(
+        const Vector3F& normal,
+        const float min_dot,
+        const size_t begin,
+        const size_t end,
+        std::vector<uint8_t>& close_faces,
+        ThreadPool& thread_pool) const;
+
+    /*!
+     * Moves some faces to the places of others, all the faces being read before any is written
+     * @param destinations The index to which each face is moved
+     * @param sources The index of each moved face
+     * @param buffer Buffer used to move the faces, whose content doesn't matter
+     */
+    void moveFaces(const std::span<const uint32_t>& destinations, const std::span<const uint32_t>& sources, FacesData& buffer);
+
+    /*!
+     * Raises the best dot product of each face of a range with a new normal, and finds the first face of the range having the lowest best dot
+     * product. The dot products are bit-identical to what Vector3F::dot() gives, whatever the instructions set used.
+     * @param normal The new normal, or nullptr to only search for the lowest best dot product
+     * @param best_dots The best dot product of each face with the normals so far, sized as the faces
+     * @param begin The index of the first face of the range
+     * @param end The index after the last face of the range
+     * @return The index of the first face having the lowest best dot product and this dot product, or end and the highest float value if there is
+     *         none
+     */
+    std::pair<size_t, float> raiseBestDots(const Vector3F* normal, std::vector<float>& best_dots, const size_t begin, const size_t end) const;
+};
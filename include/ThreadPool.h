@@ -0,0 +1,130 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * Set of worker threads that are started once and then kept waiting for work, so that parallel tasks don't pay for creating threads each time.
+ *
+ * Each thread has its own queue of tasks: a worker runs the tasks it queued itself first, and steals the oldest tasks of the other queues when it has
+ * nothing left to do. Idle workers sleep until new tasks are queued. A pool can be shared by many users at the same time, e.g. to unwrap and project
+ * in parallel without using more threads than allowed.
+ */
+class ThreadPool
+{
+public:
+    /*!
+     * Tasks that are run together, and that can be waited for
+     */
+    class TaskGroup
+    {
+    public:
+        TaskGroup() = default;
+
+        TaskGroup(const TaskGroup&) = delete;
+
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+    private:
+        friend class ThreadPool;
+
+        std::atomic<size_t> pending_tasks_{ 0 }; // Queued or running
+        std::atomic<size_t> queued_tasks_{ 0 };
+    };
+
+    /*!
+     * Starts the worker threads
+     * @param threads_count The number of threads that tasks are spread over, including the thread that waits for them. 0 means one per hardware core.
+     */
+    explicit ThreadPool(const size_t threads_count = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    /*!
+     * @return The number of threads that tasks are spread over, including the thread that waits for them
+     */
+    [[nodiscard]] size_t threadCount() const
+    {
+        return queues_.size();
+    }
+
+    /*!
+     * @return The index of the current thread in the pool, which is in the [1, threadCount()) range for the worker threads of this pool, and 0 for
+     *         any other thread
+     */
+    [[nodiscard]] size_t currentThreadIndex() const
+    {
+        return current_pool_ == this ? current_thread_index_ : 0;
+    }
+
+    /*!
+     * Queues a task to be run by any of the threads
+     * @param group The group the task belongs to, which should stay alive until it has been waited for
+     * @param task The function to be run
+     */
+    void run(TaskGroup& group, std::function<void()> task);
+
+    /*!
+     * Waits for all the tasks of a group to be completed. The calling thread runs the queued tasks of the group meanwhile.
+     * @param group The group to be waited for
+     */
+    void wait(TaskGroup& group);
+
+    /*!
+     * Processes the [0, count) range by splitting it into chunks that are distributed over the threads. The calling thread also processes chunks,
+     * and the function returns once all of them have been processed.
+     * @param count The number of items to be processed
+     * @param grain_size The minimum number of items of a chunk, so that small loops are run inline without the threading overhead
+     * @param function The function to be called for each chunk, with the [begin, end) sub-range of items it contains
+     */
+    void parallelFor(const size_t count, const size_t grain_size, const std::function<void(size_t, size_t)>& function);
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup* group{ nullptr };
+    };
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /*!
+     * Takes a task, starting with the most recent task of the queue of the current thread, then the oldest tasks of the other queues
+     * @param group If not null, only a task of this group can be taken
+     * @param task Output task, if one has been found
+     * @return True if a task has been found
+     */
+    bool takeTask(const TaskGroup* group, Task& task);
+
+    void runTask(Task& task);
+
+    void workerLoop(const size_t thread_index);
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_; // thread_index: queue of tasks queued by this thread
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_external_queue_{ 0 };
+    std::mutex mutex_;
+    std::condition_variable wake_condition_; // Notified when a task is queued
+    std::condition_variable done_condition_; // Notified when the state of a group changes
+    size_t queued_tasks_{ 0 }; // Total number of tasks in the queues, protected by the mutex
+    bool shutdown_{ false };
+    static thread_local const ThreadPool* current_pool_;
+    static thread_local size_t current_thread_index_;
+};
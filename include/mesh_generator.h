@@ -0,0 +1,69 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "Face.h"
+#include "Point3F.h"
+
+/*
+ * Procedural generation of big meshes, which are reproducible from a seed, so that the unwrapping and projection can be measured and tested on
+ * large inputs without having to store them.
+ */
+namespace mesh_generator
+{
+
+enum class Shape
+{
+    Sphere, // Smooth UV sphere, whose faces have normals in all the directions
+    Terrain, // Square grid displaced by a fractal noise, which makes many small groups of faces with similar normals
+    Lattice, // Thin beams along the 3 axes, which make many tiny charts with the same few normals
+    Islands, // Many small bumpy spheres which are not connected to each other, which make many tiny charts with various normals
+};
+
+struct GeneratorOptions
+{
+    /*! The kind of mesh to be generated */
+    Shape shape{ Shape::Sphere };
+
+    /*! Approximate number of faces of the generated mesh, the actual number depends on how the shape can be subdivided */
+    size_t faces_count{ 100'000 };
+
+    /*! Seed of the random variations of the shape, the same seed always gives the same mesh */
+    uint32_t seed{ 0 };
+
+    /*! If true, each face has its own vertices, like meshes loaded from STL files, otherwise the adjacent faces share their vertices */
+    bool soup{ false };
+
+    /*! If true, the adjacency of the faces is also calculated */
+    bool with_connectivity{ false };
+};
+
+struct GeneratedMesh
+{
+    std::vector<Point3F> vertices;
+    std::vector<Face> faces;
+
+    /*! If requested, for each face, the indices of the faces that share its i1-i2, i2-i3 and i3-i1 edges, or -1 for open edges */
+    std::vector<FaceSigned> faces_connectivity;
+};
+
+/*!
+ * Generates a mesh, whose faces are oriented outwards. The output can be directly given to smartUnwrap() and doProject().
+ * @param options The description of the mesh to be generated
+ * @return The generated mesh, which is empty if it would be too big to be indexed with 32 bits
+ */
+GeneratedMesh generateMesh(const GeneratorOptions& options);
+
+/*!
+ * @param name The lowercase name of a shape, e.g. "terrain"
+ * @return The matching shape, or nothing if the name is unknown
+ */
+std::optional<Shape> shapeFromName(const std::string_view& name);
+
+}; // namespace mesh_generator
@@ -12,6 +12,7 @@ class Point3F;
 struct Point2F;
 class Matrix44F;
 class Vector3F;
+class ThreadPool;
 
 using Polygon = std::vector<Point2F>;
 
@@ -30,6 +31,7 @@ using Polygon = std::vector<Point2F>;
  * \param viewport_height          The height of the viewport in pixels.
  * \param camera_normal            The normal vector of the camera.
  * \param face_id                  The ID of the initial face to project onto, other will be propagated using connectivity information.
+ * \param shared_thread_pool       The threads to be used for projecting the faces, or null to use only the calling thread.
  * \return A vector of polygons in UV space resulting from the projection.
  */
 std::vector<Polygon> doProject(
@@ -45,4 +47,5 @@ std::vector<Polygon> doProject(
     const uint32_t viewport_width,
     const uint32_t viewport_height,
     const Vector3F& camera_normal,
-    const uint32_t face_id);
\ No newline at end of file
+    const uint32_t face_id,
+    ThreadPool* shared_thread_pool = nullptr);
\ No newline at end of file
@@ -2,21 +2,117 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <vector>
 
 #include "Face.h"
 
 class Point3F;
 struct Point2F;
+class ThreadPool;
+
+struct UnwrapOptions
+{
+    /*! Size of the grid cells that the vertices are snapped to when detecting adjacent faces, the vertices of the same cell being considered at the same
+     *  position. Thus vertices closer than this may not be welded when they are on both sides of a cell boundary, and vertices up to sqrt(3) times
+     *  this distance apart may be welded. 0 means positions have to be strictly identical */
+    float vertices_weld_tolerance{ 0.0 };
+
+    /*! Maximum number of faces used to estimate the projection normals, picked randomly according to their area. 0 means all the faces are used */
+    size_t projection_normals_max_samples{ 0 };
+
+    /*! If true, the charts are packed by placing their bounding rectangles next to each other, then moving them down as far as their texels allow.
+     *  This is much faster for meshes with very many charts, and the atlas utilization was as good or better on the tested meshes. */
+    bool skyline_packing{ false };
+};
+
+/*!
+ * Measures of an unwrapping, to monitor where the time is spent and how well the charts could be packed. Durations are wall times in milliseconds.
+ */
+struct UnwrapStats
+{
+    double make_charts_duration{ 0.0 }; // Clustering of the faces by projection normal, and projection of the charts
+    double weld_duration{ 0.0 }; // Merging of the vertices at the same position
+    double split_charts_duration{ 0.0 }; // Splitting of the charts into groups of adjacent faces
+    double set_charts_duration{ 0.0 }; // Registration of the mesh and charts to xatlas
+    double pack_charts_duration{ 0.0 }; // Packing of the charts by xatlas, and conversion of the result
+    double total_duration{ 0.0 };
+    size_t charts_count_before_split{ 0 };
+    size_t charts_count_after_split{ 0 };
+    size_t dropped_faces_count{ 0 }; // Faces that xatlas could not add to their chart, which are then not properly unwrapped
+    float atlas_utilization{ 0.0 }; // Ratio of the texels that are covered by the charts
+    size_t scratch_memory{ 0 }; // Bytes held by the scratch buffers of the context, which is their peak usage since they are never shrunk
+};
+
+/*!
+ * Holds the resources used for unwrapping, i.e. the worker threads, the scratch buffers and the packing state. They are kept between calls, which avoids
+ * creating and destroying them each time when unwrapping many meshes. A context should be used by a single thread at a time.
+ */
+class UnwrapContext
+{
+public:
+    /*!
+     * @param threads_count The number of threads used for unwrapping, including the calling thread. 0 means one per hardware core.
+     */
+    explicit UnwrapContext(const size_t threads_count = 0);
+
+    /*!
+     * @param thread_pool The threads to be used for unwrapping, which may be shared with other contexts or tasks and should outlive the context
+     */
+    explicit UnwrapContext(ThreadPool& thread_pool);
+
+    UnwrapContext(const UnwrapContext&) = delete;
+
+    UnwrapContext& operator=(const UnwrapContext&) = delete;
+
+    ~UnwrapContext();
+
+    [[nodiscard]] ThreadPool& threadPool();
+
+    /*!
+     * Same as the global smartUnwrap(), but using the resources of the context
+     */
+    bool smartUnwrap(
+        const std::span<const Point3F>& vertices,
+        const std::span<const Face>& faces,
+        const std::span<Point2F>& uv_coords,
+        uint32_t& texture_width,
+        uint32_t& texture_height,
+        const UnwrapOptions& options = UnwrapOptions(),
+        UnwrapStats* stats = nullptr);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/*!
+ * @return The threads of the context used by smartUnwrap(), which can be shared by other tasks, e.g. given to doProject(), so that they don't create
+ *         their own threads
+ */
+[[nodiscard]] ThreadPool& defaultThreadPool();
 
 /*!
- * Groups, projects and packs the faces of the input mesh to non-overlapping and properly distributed UV coordinates patches
+ * Groups, projects and packs the faces of the input mesh to non-overlapping and properly distributed UV coordinates patches. The input and output
+ * lists are only borrowed during the call, so they can directly point to the memory of the caller, without any copy.
  * @param vertices List containing the position of the input vertices
  * @param faces List of faces composing the mesh
  * @param uv_coords Output list of UV coordinates, which should be pre-sized to the same size as the vertices
  * @param texture_width Output width to be used for the texture image
  * @param texture_height Output height to be used for the texture image
+ * @param options Optional tuning of the unwrapping
+ * @param stats Optional output measures of the unwrapping, which are filled even if it fails
  * @return
+ * @note This uses a context that is shared by all the calls, @sa UnwrapContext
  */
-bool smartUnwrap(const std::vector<Point3F>& vertices, const std::vector<Face>& faces, std::vector<Point2F>& uv_coords, uint32_t& texture_width, uint32_t& texture_height);
\ No newline at end of file
+bool smartUnwrap(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const std::span<Point2F>& uv_coords,
+    uint32_t& texture_width,
+    uint32_t& texture_height,
+    const UnwrapOptions& options = UnwrapOptions(),
+    UnwrapStats* stats = nullptr);
\ No newline at end of file
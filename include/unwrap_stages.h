@@ -0,0 +1,147 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#pragma once
+
+/*
+ * Stages of the unwrapping, which are exposed so that they can be run and measured on their own. Regular users should use smartUnwrap() or an
+ * UnwrapContext instead.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Charts.h"
+#include "Face.h"
+#include "FacesData.h"
+#include "Vector3F.h"
+
+class Point3F;
+struct Point2F;
+class ThreadPool;
+struct UnwrapStats;
+
+namespace xatlas
+{
+struct Atlas;
+} // namespace xatlas
+
+/*!
+ * Buffers used by the unwrapping stages, which are kept by the context between calls so that their memory can be reused
+ */
+struct UnwrapScratch
+{
+    FacesData faces_data;
+    FacesData sampled_faces_data;
+    std::vector<uint32_t> best_normals;
+    std::vector<uint32_t> blocks_histograms;
+    std::vector<uint64_t> vertices_hashes;
+    std::vector<uint32_t> sorted_vertices;
+    std::vector<uint32_t> new_vertices_indices;
+    std::vector<Face> faces_with_similar_indices;
+
+    /*!
+     * @return The number of bytes allocated by the buffers
+     */
+    [[nodiscard]] size_t memoryUsage() const
+    {
+        size_t memory_usage = faces_data.memoryUsage() + sampled_faces_data.memoryUsage();
+        memory_usage += (best_normals.capacity() + blocks_histograms.capacity() + sorted_vertices.capacity() + new_vertices_indices.capacity()) * sizeof(uint32_t);
+        memory_usage += vertices_hashes.capacity() * sizeof(uint64_t);
+        memory_usage += faces_with_similar_indices.capacity() * sizeof(Face);
+        return memory_usage;
+    }
+};
+
+/*!
+ * Calculate the best projection normals according to the given input faces
+ * @param faces_data The faces data
+ * @param thread_pool The threads to run the calculation on
+ * @return A list of normals that are far enough from each other
+ */
+std::vector<Vector3F> calculateProjectionNormals(const FacesData& faces_data, ThreadPool& thread_pool);
+
+/*!
+ * Groups the faces that have a similar normal, and project their points as raw UV coordinates along this normal
+ * @param vertices The list of vertices positions
+ * @param faces The list of faces we want to project
+ * @param uv_coords The UV coordinates, which should be properly sized but the input content doesn't matter. As output, they will be filled with
+ *                  raw UV coordinates that overlap and are not in the [0,1] range
+ * @param projection_normals_max_samples The maximum number of faces used to calculate the projection normals, or 0 to use all of them
+ * @param thread_pool The threads to run the calculation on
+ * @param scratch The buffers to be used for intermediate calculations
+ * @return The groups of faces indices, in which the faces are ordered by index
+ */
+Charts makeCharts(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const std::span<Point2F>& uv_coords,
+    const size_t projection_normals_max_samples,
+    ThreadPool& thread_pool,
+    UnwrapScratch& scratch);
+
+/*!
+ * When loading the mesh, each vertex of each triangle is given a unique index, even if it is used in multiple adjacent triangles. The purpose
+ * of this function is to remove double vertices so that we can make adjacency detection easier.
+ *
+ * The vertices are distributed in buckets according to the hash of their position, then each bucket is welded independently by using an
+ * open-addressing hash table. Since the vertices are processed by increasing index in each bucket, a vertex is always replaced by the first
+ * vertex having the same position.
+ * @param faces The original list of faces
+ * @param vertices The original list of vertices position
+ * @param weld_tolerance If not 0, the positions are snapped to a grid of this size, and vertices in the same grid cell are merged
+ * @param thread_pool The threads to run the calculation on
+ * @param scratch The buffers to be used for intermediate calculations
+ * @return The modified list of faces, which contains as many faces but with merged vertices. It is stored in the scratch buffers.
+ */
+const std::vector<Face>& groupSimilarVertices(
+    const std::span<const Face>& faces,
+    const std::span<const Point3F>& vertices,
+    const float weld_tolerance,
+    ThreadPool& thread_pool,
+    UnwrapScratch& scratch);
+
+/*!
+ * When projecting faces groups along a normal, it is possible that we project faces that are actually far away from each other spatially. This sometimes
+ * results in overlapping projections, which we really want to avoid. The purpose of this function is to make sub-groups of faces groups for faces that are
+ * adjacent to each other.
+ *
+ * Each group is split by a union-find over its faces, faces being linked when they share a vertex. The groups are independent, so they are processed in
+ * parallel. The vertices of a group are found in a hash table sized to the group, which each worker reuses for all the groups it processes, so the
+ * memory used doesn't depend on the number of vertices of the mesh nor on the number of threads.
+ * @param grouped_faces Contains the grouped indices of faces
+ * @param faces The actual faces definitions, whose vertices should have been merged before, @sa groupSimilarVertices()
+ * @param thread_pool The threads to run the calculation on
+ * @return Grouped faces with groups containing only adjacent faces. It may be identical to the original groups, or contain more smaller groups. The
+ *         sub-groups are ordered by their first face, and keep the faces in their original order.
+ */
+Charts splitNonLinkedFacesCharts(
+    const Charts& grouped_faces,
+    const std::span<const Face>& faces,
+    ThreadPool& thread_pool);
+
+/*!
+ * Packs the charts (faces groups) onto a texture image by using as much space as possible without having them overlap
+ * @param vertices The list of vertices position
+ * @param faces The list of faces
+ * @param charts The list of grouped faces indices
+ * @param uv_coords The original UV coordinates, which may be overlapping and not fitting on an image. As an output they
+ *                  will be properly scaled and distributed on the image.
+ * @param texture_width Output width to be used for the texture image
+ * @param texture_height Output height to be used for the texture image
+ * @param skyline_packing If true, the charts are placed by their bounding rectangles, see UnwrapOptions
+ * @param atlas The xatlas object to be used for packing, which is left empty so that it can be used again
+ * @param stats Output measures of the packing
+ * @return True if the packing succeeded, false otherwise
+ */
+bool packCharts(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const Charts& charts,
+    const std::span<Point2F>& uv_coords,
+    uint32_t& texture_width,
+    uint32_t& texture_height,
+    const bool skyline_packing,
+    xatlas::Atlas* atlas,
+    UnwrapStats& stats);
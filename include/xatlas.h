@@ -31,7 +31,8 @@ Copyright NVIDIA Corporation 2006 -- Ignacio Castano <icastano@nvidia.com>
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
-#include <vector>
+
+class ThreadPool;
 
 namespace xatlas
 {
@@ -79,11 +80,23 @@ struct Atlas
     float texelsPerUnit; // Equal to PackOptions texelsPerUnit if texelsPerUnit > 0, otherwise an estimated value to match PackOptions resolution.
 };
 
-// Create an empty atlas.
-Atlas* Create();
+// Create an empty atlas. Tasks are run on the given thread pool, or on an internal one with a thread per hardware core if it is null.
+Atlas* Create(ThreadPool* threadPool = nullptr);
 
 void Destroy(Atlas* atlas);
 
+// Remove all the meshes and results from the atlas, so that it can be used again for other meshes without being re-created.
+void ClearMeshes(Atlas* atlas);
+
+enum class Allocator
+{
+    Heap, // Each allocation is made and released on its own.
+    Arena // The allocations are taken from a monotonic arena of the atlas, and only released all at once by ClearMeshes, which keeps the memory for the next meshes. Much faster with many charts.
+};
+
+// Chooses how the meshes, charts and results of the atlas are allocated. Can only be called while the atlas has no meshes, e.g. after ClearMeshes.
+void SetAllocator(Atlas* atlas, Allocator allocator);
+
 enum class IndexFormat
 {
     UInt16,
@@ -109,11 +122,24 @@ struct UvMeshDecl
     uint32_t indexCount = 0;
     int32_t indexOffset = 0; // optional. Add this offset to all indices.
     IndexFormat indexFormat = IndexFormat::UInt16;
+    // Optional. Reference the data instead of copying it, so it must stay valid and unchanged until the last call to SetCharts or PackCharts for this mesh.
+    // Only the data which is already in the layout of the mesh is referenced, i.e. UInt32 indices without indexOffset and texcoords with a vertexStride of 8,
+    // the rest is still copied.
+    bool borrowData = false;
 };
 
 AddMeshError AddUvMesh(Atlas* atlas, const UvMeshDecl& decl);
 
-void SetCharts(Atlas* atlas, const std::vector<std::vector<size_t>>& grouped_faces);
+// Sets the charts of the meshes, the faces of chart i being chartFaces[chartOffsets[i]] to chartFaces[chartOffsets[i + 1] - 1], so chartOffsets must
+// contain chartCount + 1 offsets. Returns the number of faces that could not be added to their chart, e.g. because they are ignored or a vertex is
+// already used by another chart.
+uint32_t SetCharts(Atlas* atlas, const uint32_t* chartFaces, const uint32_t* chartOffsets, uint32_t chartCount);
+
+enum class PackStrategy
+{
+    Bitmap, // Test the texels of the charts against the ones of the atlas at random locations, or at all of them if bruteForce is set.
+    Skyline // Place the bounding rectangles of the charts on top of the ones already placed, then move them down as far as their texels allow. Much faster with many charts, and the utilization was as good or better on the tested meshes.
+};
 
 struct PackOptions
 {
@@ -147,6 +173,9 @@ struct PackOptions
 
     // Rotate charts to improve packing.
     bool rotateCharts = true;
+
+    // How the locations of the charts in the atlas are searched.
+    PackStrategy strategy = PackStrategy::Bitmap;
 };
 
 // Call after ComputeCharts. Can be called multiple times to re-pack charts with different options.
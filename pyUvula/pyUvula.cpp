@@ -1,5 +1,8 @@
 ﻿// (c) 2025, UltiMaker -- see LICENCE for details
 
+#include <algorithm>
+#include <span>
+
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
@@ -13,25 +16,31 @@
 
 namespace py = pybind11;
 
-py::tuple pyUnwrap(const py::array_t<float>& vertices_array, const py::array_t<int32_t>& indices_array)
+using VerticesArray = py::array_t<float, py::array::c_style | py::array::forcecast>;
+using IndicesArray = py::array_t<int32_t, py::array::c_style | py::array::forcecast>;
+
+static py::tuple unwrapArrays(
+    const VerticesArray& vertices_array,
+    const IndicesArray& indices_array,
+    const float weld_tolerance,
+    const size_t normal_samples,
+    UnwrapStats* stats)
 {
-    // input shaping
+    // input shaping, the arrays memory is directly used without copying it
     const pybind11::buffer_info vertices_buf = vertices_array.request();
     const pybind11::buffer_info indices_buf = indices_array.request();
-    if (vertices_buf.ndim != 2 || indices_buf.ndim != 2)
+    if (vertices_buf.ndim != 2 || indices_buf.ndim != 2 || vertices_buf.shape[1] != 3 || indices_buf.shape[1] != 3)
     {
         throw std::runtime_error("Vertices should be <float, float, float> and indices should be (grouped by face as) <int, int, int>.");
     }
 
-    const auto* vertices_ptr = static_cast<Point3F*>(vertices_buf.ptr);
-    const auto* indices_ptr = static_cast<Face*>(indices_buf.ptr);
-    const auto vertices = std::vector<Point3F>(vertices_ptr, vertices_ptr + vertices_buf.shape[0]);
-    const auto indices = std::vector<Face>(indices_ptr, indices_ptr + indices_buf.shape[0]);
+    const std::span<const Point3F> vertices(static_cast<const Point3F*>(vertices_buf.ptr), vertices_buf.shape[0]);
+    const std::span<const Face> indices(static_cast<const Face*>(indices_buf.ptr), indices_buf.shape[0]);
 
-    // output shaping
-    const std::vector<py::ssize_t> shape = { static_cast<py::ssize_t>(vertices.size()), 2 };
-    const std::vector<py::ssize_t> strides = { static_cast<py::ssize_t>(sizeof(float) * shape[1]), static_cast<py::ssize_t>(sizeof(float)) };
-    std::vector<Point2F> res(shape[0], { 0.0, 0.0 });
+    // output shaping, the result is directly written to the returned array
+    py::array_t<float> uv_array({ static_cast<py::ssize_t>(vertices.size()), static_cast<py::ssize_t>(2) });
+    const std::span<Point2F> uv_coords(reinterpret_cast<Point2F*>(uv_array.mutable_data()), vertices.size());
+    std::fill(uv_coords.begin(), uv_coords.end(), Point2F{ 0.0, 0.0 });
     uint32_t texture_width;
     uint32_t texture_height;
 
@@ -39,14 +48,27 @@ py::tuple pyUnwrap(const py::array_t<float>& vertices_array, const py::array_t<i
         py::gil_scoped_release release;
 
         // Do the actual calculation here
-        if (! smartUnwrap(vertices, indices, res, texture_width, texture_height))
+        const UnwrapOptions options{ .vertices_weld_tolerance = weld_tolerance, .projection_normals_max_samples = normal_samples };
+        if (! smartUnwrap(vertices, indices, uv_coords, texture_width, texture_height, options, stats))
         {
             throw std::runtime_error("Couldn't unwrap UV's!");
         }
     }
 
     // send output
-    return py::make_tuple(py::array(py::buffer_info(res.data(), strides[1], py::format_descriptor<float>::format(), shape.size(), shape, strides)), texture_width, texture_height);
+    return py::make_tuple(uv_array, texture_width, texture_height);
+}
+
+py::tuple pyUnwrap(const VerticesArray& vertices_array, const IndicesArray& indices_array, const float weld_tolerance, const size_t normal_samples)
+{
+    return unwrapArrays(vertices_array, indices_array, weld_tolerance, normal_samples, nullptr);
+}
+
+py::tuple pyUnwrapWithStats(const VerticesArray& vertices_array, const IndicesArray& indices_array, const float weld_tolerance, const size_t normal_samples)
+{
+    UnwrapStats stats;
+    const py::tuple result = unwrapArrays(vertices_array, indices_array, weld_tolerance, normal_samples, &stats);
+    return py::make_tuple(result[0], result[1], result[2], stats);
 }
 
 py::list pyProject(
@@ -86,20 +108,27 @@ py::list pyProject(
     const float* camera_normal_ptr = static_cast<float*>(camera_normal_buf.ptr);
     const Vector3F camera_normal(camera_normal_ptr[0], camera_normal_ptr[1], camera_normal_ptr[2]);
 
-    std::vector<Polygon> result = doProject(
-        stroke_polygon,
-        mesh_vertices,
-        mesh_indices,
-        mesh_uv,
-        mesh_faces_connectivity,
-        texture_width,
-        texture_height,
-        camera_projection_matrix,
-        is_camera_perspective,
-        viewport_width,
-        viewport_height,
-        camera_normal,
-        face_id);
+    std::vector<Polygon> result;
+    {
+        py::gil_scoped_release release;
+
+        // Share the threads of the unwrapping, rather than projecting on the calling thread only
+        result = doProject(
+            stroke_polygon,
+            mesh_vertices,
+            mesh_indices,
+            mesh_uv,
+            mesh_faces_connectivity,
+            texture_width,
+            texture_height,
+            camera_projection_matrix,
+            is_camera_perspective,
+            viewport_width,
+            viewport_height,
+            camera_normal,
+            face_id,
+            &defaultThreadPool());
+    }
 
     py::list py_result;
     for (Polygon& polygon : result)
@@ -122,6 +151,34 @@ PYBIND11_MODULE(pyUvula, module)
     module.doc() = "UV-unwrapping library (or bindings to library), segmentation uses a classic normal-based grouping and charts packing uses xatlas";
     module.attr("__version__") = PYUVULA_VERSION;
 
-    module.def("unwrap", &pyUnwrap, "Given the vertices, indices of a mesh, unwrap UV for texture-coordinates.");
+    py::class_<UnwrapStats>(module, "UnwrapStats", "Measures of an unwrapping, durations are wall times in milliseconds")
+        .def_readonly("make_charts_duration", &UnwrapStats::make_charts_duration)
+        .def_readonly("weld_duration", &UnwrapStats::weld_duration)
+        .def_readonly("split_charts_duration", &UnwrapStats::split_charts_duration)
+        .def_readonly("set_charts_duration", &UnwrapStats::set_charts_duration)
+        .def_readonly("pack_charts_duration", &UnwrapStats::pack_charts_duration)
+        .def_readonly("total_duration", &UnwrapStats::total_duration)
+        .def_readonly("charts_count_before_split", &UnwrapStats::charts_count_before_split)
+        .def_readonly("charts_count_after_split", &UnwrapStats::charts_count_after_split)
+        .def_readonly("dropped_faces_count", &UnwrapStats::dropped_faces_count)
+        .def_readonly("atlas_utilization", &UnwrapStats::atlas_utilization)
+        .def_readonly("scratch_memory", &UnwrapStats::scratch_memory);
+
+    module.def(
+        "unwrap",
+        &pyUnwrap,
+        "Given the vertices, indices of a mesh, unwrap UV for texture-coordinates.",
+        py::arg("vertices"),
+        py::arg("indices"),
+        py::arg("weld_tolerance") = 0.0f,
+        py::arg("normal_samples") = 0);
+    module.def(
+        "unwrap_with_stats",
+        &pyUnwrapWithStats,
+        "Same as unwrap, but also returns the measures of the unwrapping as a fourth value.",
+        py::arg("vertices"),
+        py::arg("indices"),
+        py::arg("weld_tolerance") = 0.0f,
+        py::arg("normal_samples") = 0);
     module.def("project", &pyProject, "Projects a stroke polygon into an object texture.");
 }
@@ -0,0 +1,425 @@
+#include "FacesData.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define UVULA_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include "Point3F.h"
+#include "ThreadPool.h"
+
+static_assert(sizeof(Point3F) == 3 * sizeof(float), "Point3F is expected to be made of packed coordinates");
+static_assert(sizeof(Face) == 3 * sizeof(uint32_t), "Face is expected to be made of packed indices");
+
+namespace
+{
+
+constexpr size_t grain_size = 16384;
+constexpr uint32_t degenerate_face = std::numeric_limits<uint32_t>::max();
+
+/*
+ * All the kernels below do exactly the same operations, in the same order, as Vector3F does, and don't use fused multiply-add, so that the results are
+ * bit-identical whatever the instructions set.
+ */
+
+void computeFacesRange(const float* positions, const uint32_t* indices, const size_t begin, const size_t end, FacesData& faces_data)
+{
+    for (size_t index = begin; index < end; ++index)
+    {
+        const float* p1 = positions + (static_cast<size_t>(indices[(index * 3)]) * 3);
+        const float* p2 = positions + (static_cast<size_t>(indices[(index * 3) + 1]) * 3);
+        const float* p3 = positions + (static_cast<size_t>(indices[(index * 3) + 2]) * 3);
+
+        const float e1x = p2[0] - p1[0];
+        const float e1y = p2[1] - p1[1];
+        const float e1z = p2[2] - p1[2];
+        const float e2x = p3[0] - p1[0];
+        const float e2y = p3[1] - p1[1];
+        const float e2z = p3[2] - p1[2];
+
+        const float cross_x = (e1y * e2z) - (e1z * e2y);
+        const float cross_y = (e1z * e2x) - (e1x * e2z);
+        const float cross_z = (e1x * e2y) - (e1y * e2x);
+        const float length = std::sqrt((cross_x * cross_x) + (cross_y * cross_y) + (cross_z * cross_z));
+
+        faces_data.face_index[index] = length > std::numeric_limits<float>::epsilon() ? static_cast<uint32_t>(index) : degenerate_face;
+        faces_data.normal_x[index] = cross_x / length;
+        faces_data.normal_y[index] = cross_y / length;
+        faces_data.normal_z[index] = cross_z / length;
+        faces_data.area[index] = length / 2;
+    }
+}
+
+void findBestNormalsRange(const FacesData& faces_data, const std::vector<Vector3F>& normals, const size_t begin, const size_t end, uint32_t* best_normals)
+{
+    for (size_t index = begin; index < end; ++index)
+    {
+        const float normal_x = faces_data.normal_x[index];
+        const float normal_y = faces_data.normal_y[index];
+        const float normal_z = faces_data.normal_z[index];
+        float best_dot = std::numeric_limits<float>::lowest();
+        uint32_t best_normal = 0;
+
+        for (size_t normal_index = 0; normal_index < normals.size(); ++normal_index)
+        {
+            const Vector3F& normal = normals[normal_index];
+            const float dot = (normal_x * normal.x()) + (normal_y * normal.y()) + (normal_z * normal.z());
+            if (dot > best_dot)
+            {
+                best_dot = dot;
+                best_normal = static_cast<uint32_t>(normal_index);
+            }
+        }
+
+        best_normals[index] = best_normal;
+    }
+}
+
+std::pair<size_t, float> raiseBestDotsRange(const FacesData& faces_data, const Vector3F* normal, float* best_dots, const size_t begin, const size_t end)
+{
+    size_t lowest_index = end;
+    float lowest_dot = std::numeric_limits<float>::max();
+    for (size_t index = begin; index < end; ++index)
+    {
+        if (normal != nullptr)
+        {
+            const float dot = (normal->x() * faces_data.normal_x[index]) + (normal->y() * faces_data.normal_y[index]) + (normal->z() * faces_data.normal_z[index]);
+            best_dots[index] = std::max(best_dots[index], dot);
+        }
+
+        if (best_dots[index] < lowest_dot)
+        {
+            lowest_dot = best_dots[index];
+            lowest_index = index;
+        }
+    }
+
+    return { lowest_index, lowest_dot };
+}
+
+void findCloseFacesRange(const FacesData& faces_data, const Vector3F& normal, const float min_dot, const size_t begin, const size_t end, uint8_t* close_faces)
+{
+    for (size_t index = begin; index < end; ++index)
+    {
+        const float dot = (faces_data.normal_x[index] * normal.x()) + (faces_data.normal_y[index] * normal.y()) + (faces_data.normal_z[index] * normal.z());
+        close_faces[index - begin] = dot > min_dot ? 1 : 0;
+    }
+}
+
+template<typename T>
+void moveValues(std::vector<T>& values, const std::span<const uint32_t>& destinations, const std::span<const uint32_t>& sources, std::vector<T>& buffer)
+{
+    buffer.resize(sources.size());
+    for (size_t index = 0; index < sources.size(); ++index)
+    {
+        buffer[index] = values[sources[index]];
+    }
+    for (size_t index = 0; index < destinations.size(); ++index)
+    {
+        values[destinations[index]] = buffer[index];
+    }
+}
+
+#ifdef UVULA_AVX2_DISPATCH
+
+bool hasAvx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+__attribute__((target("avx2"))) void
+    computeFacesRangeAvx2(const float* positions, const uint32_t* indices, const size_t begin, const size_t end, FacesData& faces_data)
+{
+    constexpr size_t batch_size = 8;
+    const __m256i faces_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i degenerate = _mm256_set1_epi32(static_cast<int>(degenerate_face));
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 epsilon = _mm256_set1_ps(std::numeric_limits<float>::epsilon());
+
+    size_t index = begin;
+    for (; index + batch_size <= end; index += batch_size)
+    {
+        const auto* face_indices = reinterpret_cast<const int*>(indices + (index * 3));
+        const __m256i offset1 = _mm256_mullo_epi32(_mm256_i32gather_epi32(face_indices, faces_offsets, 4), three);
+        const __m256i offset2 = _mm256_mullo_epi32(_mm256_i32gather_epi32(face_indices + 1, faces_offsets, 4), three);
+        const __m256i offset3 = _mm256_mullo_epi32(_mm256_i32gather_epi32(face_indices + 2, faces_offsets, 4), three);
+
+        const __m256 p1x = _mm256_i32gather_ps(positions, offset1, 4);
+        const __m256 p1y = _mm256_i32gather_ps(positions + 1, offset1, 4);
+        const __m256 p1z = _mm256_i32gather_ps(positions + 2, offset1, 4);
+
+        const __m256 e1x = _mm256_sub_ps(_mm256_i32gather_ps(positions, offset2, 4), p1x);
+        const __m256 e1y = _mm256_sub_ps(_mm256_i32gather_ps(positions + 1, offset2, 4), p1y);
+        const __m256 e1z = _mm256_sub_ps(_mm256_i32gather_ps(positions + 2, offset2, 4), p1z);
+        const __m256 e2x = _mm256_sub_ps(_mm256_i32gather_ps(positions, offset3, 4), p1x);
+        const __m256 e2y = _mm256_sub_ps(_mm256_i32gather_ps(positions + 1, offset3, 4), p1y);
+        const __m256 e2z = _mm256_sub_ps(_mm256_i32gather_ps(positions + 2, offset3, 4), p1z);
+
+        const __m256 cross_x = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+        const __m256 cross_y = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+        const __m256 cross_z = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+        const __m256 length = _mm256_sqrt_ps(
+            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cross_x, cross_x), _mm256_mul_ps(cross_y, cross_y)), _mm256_mul_ps(cross_z, cross_z)));
+
+        const __m256i valid = _mm256_castps_si256(_mm256_cmp_ps(length, epsilon, _CMP_GT_OQ));
+        const __m256i faces_indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(index)), lanes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(faces_data.face_index.data() + index), _mm256_blendv_epi8(degenerate, faces_indices, valid));
+        _mm256_storeu_ps(faces_data.normal_x.data() + index, _mm256_div_ps(cross_x, length));
+        _mm256_storeu_ps(faces_data.normal_y.data() + index, _mm256_div_ps(cross_y, length));
+        _mm256_storeu_ps(faces_data.normal_z.data() + index, _mm256_div_ps(cross_z, length));
+        _mm256_storeu_ps(faces_data.area.data() + index, _mm256_div_ps(length, two));
+    }
+
+    computeFacesRange(positions, indices, index, end, faces_data);
+}
+
+__attribute__((target("avx2"))) void
+    findBestNormalsRangeAvx2(const FacesData& faces_data, const std::vector<Vector3F>& normals, const size_t begin, const size_t end, uint32_t* best_normals)
+{
+    constexpr size_t batch_size = 8;
+
+    size_t index = begin;
+    for (; index + batch_size <= end; index += batch_size)
+    {
+        const __m256 normal_x = _mm256_loadu_ps(faces_data.normal_x.data() + index);
+        const __m256 normal_y = _mm256_loadu_ps(faces_data.normal_y.data() + index);
+        const __m256 normal_z = _mm256_loadu_ps(faces_data.normal_z.data() + index);
+        __m256 best_dot = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+        __m256i best_normal = _mm256_setzero_si256();
+
+        for (size_t normal_index = 0; normal_index < normals.size(); ++normal_index)
+        {
+            const Vector3F& normal = normals[normal_index];
+            const __m256 dot = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(normal_x, _mm256_set1_ps(normal.x())), _mm256_mul_ps(normal_y, _mm256_set1_ps(normal.y()))),
+                _mm256_mul_ps(normal_z, _mm256_set1_ps(normal.z())));
+            const __m256 better = _mm256_cmp_ps(dot, best_dot, _CMP_GT_OQ);
+            best_dot = _mm256_blendv_ps(best_dot, dot, better);
+            best_normal = _mm256_blendv_epi8(best_normal, _mm256_set1_epi32(static_cast<int>(normal_index)), _mm256_castps_si256(better));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(best_normals + index), best_normal);
+    }
+
+    findBestNormalsRange(faces_data, normals, index, end, best_normals);
+}
+
+__attribute__((target("avx2"))) void findCloseFacesRangeAvx2(
+    const FacesData& faces_data,
+    const Vector3F& normal,
+    const float min_dot,
+    const size_t begin,
+    const size_t end,
+    uint8_t* close_faces)
+{
+    constexpr size_t batch_size = 8;
+    const __m256 min_dots = _mm256_set1_ps(min_dot);
+
+    size_t index = begin;
+    for (; index + batch_size <= end; index += batch_size)
+    {
+        const __m256 dot = _mm256_add_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(_mm256_loadu_ps(faces_data.normal_x.data() + index), _mm256_set1_ps(normal.x())),
+                _mm256_mul_ps(_mm256_loadu_ps(faces_data.normal_y.data() + index), _mm256_set1_ps(normal.y()))),
+            _mm256_mul_ps(_mm256_loadu_ps(faces_data.normal_z.data() + index), _mm256_set1_ps(normal.z())));
+        const int close_mask = _mm256_movemask_ps(_mm256_cmp_ps(dot, min_dots, _CMP_GT_OQ));
+        for (size_t lane = 0; lane < batch_size; ++lane)
+        {
+            close_faces[index - begin + lane] = (close_mask >> lane) & 1;
+        }
+    }
+
+    findCloseFacesRange(faces_data, normal, min_dot, index, end, close_faces + (index - begin));
+}
+
+__attribute__((target("avx2"))) std::pair<size_t, float>
+    raiseBestDotsRangeAvx2(const FacesData& faces_data, const Vector3F* normal, float* best_dots, const size_t begin, const size_t end)
+{
+    constexpr size_t batch_size = 8;
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    // Each lane keeps its first lowest dot product, and its index relative to the beginning of the range
+    __m256 lowest_dots = _mm256_set1_ps(std::numeric_limits<float>::max());
+    __m256i lowest_indices = _mm256_set1_epi32(-1);
+
+    size_t index = begin;
+    for (; index + batch_size <= end; index += batch_size)
+    {
+        __m256 dots = _mm256_loadu_ps(best_dots + index);
+        if (normal != nullptr)
+        {
+            const __m256 dot = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_mul_ps(_mm256_set1_ps(normal->x()), _mm256_loadu_ps(faces_data.normal_x.data() + index)),
+                    _mm256_mul_ps(_mm256_set1_ps(normal->y()), _mm256_loadu_ps(faces_data.normal_y.data() + index))),
+                _mm256_mul_ps(_mm256_set1_ps(normal->z()), _mm256_loadu_ps(faces_data.normal_z.data() + index)));
+            dots = _mm256_max_ps(dot, dots); // Keeps the previous best dot product unless the new one is greater, like std::max()
+            _mm256_storeu_ps(best_dots + index, dots);
+        }
+
+        const __m256 lower = _mm256_cmp_ps(dots, lowest_dots, _CMP_LT_OQ);
+        lowest_dots = _mm256_blendv_ps(lowest_dots, dots, lower);
+        const __m256i indices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(index - begin)), lanes);
+        lowest_indices = _mm256_blendv_epi8(lowest_indices, indices, _mm256_castps_si256(lower));
+    }
+
+    // The lowest dot product of all the lanes, with the first index in case of equality
+    alignas(32) float lanes_dots[batch_size];
+    alignas(32) int32_t lanes_indices[batch_size];
+    _mm256_store_ps(lanes_dots, lowest_dots);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes_indices), lowest_indices);
+    size_t lowest_index = end;
+    float lowest_dot = std::numeric_limits<float>::max();
+    for (size_t lane = 0; lane < batch_size; ++lane)
+    {
+        if (lanes_indices[lane] < 0)
+        {
+            continue;
+        }
+
+        const size_t lane_index = begin + static_cast<size_t>(lanes_indices[lane]);
+        if (lanes_dots[lane] < lowest_dot || (lanes_dots[lane] == lowest_dot && lane_index < lowest_index))
+        {
+            lowest_dot = lanes_dots[lane];
+            lowest_index = lane_index;
+        }
+    }
+
+    // The remaining faces come after all the others, so they are only taken if strictly lower
+    const auto [remaining_lowest_index, remaining_lowest_dot] = raiseBestDotsRange(faces_data, normal, best_dots, index, end);
+    if (remaining_lowest_dot < lowest_dot)
+    {
+        return { remaining_lowest_index, remaining_lowest_dot };
+    }
+    return { lowest_index, lowest_dot };
+}
+
+#endif
+
+} // namespace
+
+void FacesData::fill(const std::span<const Point3F>& vertices, const std::span<const Face>& faces, ThreadPool& thread_pool)
+{
+    face_index.resize(faces.size());
+    normal_x.resize(faces.size());
+    normal_y.resize(faces.size());
+    normal_z.resize(faces.size());
+    area.resize(faces.size());
+
+    const auto* positions = reinterpret_cast<const float*>(vertices.data());
+    const auto* indices = reinterpret_cast<const uint32_t*>(faces.data());
+    auto compute_faces_range = &computeFacesRange;
+#ifdef UVULA_AVX2_DISPATCH
+    // Gathers use signed 32-bits offsets to the coordinates
+    if (hasAvx2() && vertices.size() <= static_cast<size_t>(std::numeric_limits<int32_t>::max() / 3))
+    {
+        compute_faces_range = &computeFacesRangeAvx2;
+    }
+#endif
+
+    thread_pool.parallelFor(
+        faces.size(),
+        grain_size,
+        [&](const size_t begin, const size_t end)
+        {
+            compute_faces_range(positions, indices, begin, end, *this);
+        });
+
+    // Now remove the degenerate faces, keeping the others in their original order
+    size_t valid_faces_count = 0;
+    for (size_t index = 0; index < faces.size(); ++index)
+    {
+        if (face_index[index] != degenerate_face) [[likely]]
+        {
+            face_index[valid_faces_count] = face_index[index];
+            normal_x[valid_faces_count] = normal_x[index];
+            normal_y[valid_faces_count] = normal_y[index];
+            normal_z[valid_faces_count] = normal_z[index];
+            area[valid_faces_count] = area[index];
+            ++valid_faces_count;
+        }
+    }
+
+    face_index.resize(valid_faces_count);
+    normal_x.resize(valid_faces_count);
+    normal_y.resize(valid_faces_count);
+    normal_z.resize(valid_faces_count);
+    area.resize(valid_faces_count);
+}
+
+void FacesData::findBestNormals(const std::vector<Vector3F>& normals, std::vector<uint32_t>& best_normals, ThreadPool& thread_pool) const
+{
+    best_normals.resize(size());
+
+    auto find_best_normals_range = &findBestNormalsRange;
+#ifdef UVULA_AVX2_DISPATCH
+    if (hasAvx2())
+    {
+        find_best_normals_range = &findBestNormalsRangeAvx2;
+    }
+#endif
+
+    thread_pool.parallelFor(
+        size(),
+        grain_size,
+        [&](const size_t begin, const size_t end)
+        {
+            find_best_normals_range(*this, normals, begin, end, best_normals.data());
+        });
+}
+
+void FacesData::findCloseFaces(
+    const Vector3F& normal,
+    const float min_dot,
+    const size_t begin,
+    const size_t end,
+    std::vector<uint8_t>& close_faces,
+    ThreadPool& thread_pool) const
+{
+    close_faces.resize(end - begin);
+
+    auto find_close_faces_range = &findCloseFacesRange;
+#ifdef UVULA_AVX2_DISPATCH
+    if (hasAvx2())
+    {
+        find_close_faces_range = &findCloseFacesRangeAvx2;
+    }
+#endif
+
+    thread_pool.parallelFor(
+        end - begin,
+        grain_size,
+        [&](const size_t range_begin, const size_t range_end)
+        {
+            find_close_faces_range(*this, normal, min_dot, begin + range_begin, begin + range_end, close_faces.data() + range_begin);
+        });
+}
+
+void FacesData::moveFaces(const std::span<const uint32_t>& destinations, const std::span<const uint32_t>& sources, FacesData& buffer)
+{
+    moveValues(face_index, destinations, sources, buffer.face_index);
+    moveValues(normal_x, destinations, sources, buffer.normal_x);
+    moveValues(normal_y, destinations, sources, buffer.normal_y);
+    moveValues(normal_z, destinations, sources, buffer.normal_z);
+    moveValues(area, destinations, sources, buffer.area);
+}
+
+std::pair<size_t, float> FacesData::raiseBestDots(const Vector3F* normal, std::vector<float>& best_dots, const size_t begin, const size_t end) const
+{
+#ifdef UVULA_AVX2_DISPATCH
+    if (hasAvx2())
+    {
+        return raiseBestDotsRangeAvx2(*this, normal, best_dots.data(), begin, end);
+    }
+#endif
+
+    return raiseBestDotsRange(*this, normal, best_dots.data(), begin, end);
+}
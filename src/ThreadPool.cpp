@@ -0,0 +1,207 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+
+thread_local const ThreadPool* ThreadPool::current_pool_ = nullptr;
+thread_local size_t ThreadPool::current_thread_index_ = 0;
+
+ThreadPool::ThreadPool(const size_t threads_count)
+{
+    const size_t actual_threads_count = threads_count > 0 ? threads_count : std::max(1u, std::thread::hardware_concurrency());
+
+    queues_.reserve(actual_threads_count);
+    for (size_t i = 0; i < actual_threads_count; ++i)
+    {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+
+    workers_.reserve(actual_threads_count - 1);
+    for (size_t i = 1; i < actual_threads_count; ++i)
+    {
+        workers_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mutex_);
+        shutdown_ = true;
+    }
+    wake_condition_.notify_all();
+
+    for (std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void()> task)
+{
+    ++group.pending_tasks_;
+    ++group.queued_tasks_;
+
+    // Workers queue their tasks in their own queue, other threads spread them over all the queues
+    const size_t queue_index = current_pool_ == this ? current_thread_index_ : next_external_queue_++ % queues_.size();
+    {
+        TaskQueue& queue = *queues_[queue_index];
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(Task{ .function = std::move(task), .group = &group });
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        ++queued_tasks_;
+    }
+    wake_condition_.notify_one();
+    done_condition_.notify_all(); // A thread waiting for the group may run the task
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    while (group.pending_tasks_ > 0)
+    {
+        Task task;
+        if (takeTask(&group, task))
+        {
+            runTask(task);
+            continue;
+        }
+
+        // All the tasks of the group are being run by other threads, sleep until they are done or new ones are queued
+        std::unique_lock lock(mutex_);
+        done_condition_.wait(
+            lock,
+            [&group]()
+            {
+                return group.pending_tasks_ == 0 || group.queued_tasks_ > 0;
+            });
+    }
+}
+
+void ThreadPool::parallelFor(const size_t count, const size_t grain_size, const std::function<void(size_t, size_t)>& function)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Make a few chunks per thread so that uneven chunks can still be balanced
+    constexpr size_t chunks_per_thread = 4;
+    const size_t threads_count = threadCount();
+    const size_t chunk_size = std::max({ grain_size, (count + (threads_count * chunks_per_thread) - 1) / (threads_count * chunks_per_thread), size_t(1) });
+    const size_t chunks_count = (count + chunk_size - 1) / chunk_size;
+    const size_t workers_count = std::min(threads_count, chunks_count);
+
+    if (workers_count <= 1)
+    {
+        function(0, count);
+        return;
+    }
+
+    std::atomic<size_t> next_chunk{ 0 };
+    const auto process_chunks = [&]()
+    {
+        for (size_t chunk = next_chunk++; chunk < chunks_count; chunk = next_chunk++)
+        {
+            const size_t begin = chunk * chunk_size;
+            function(begin, std::min(begin + chunk_size, count));
+        }
+    };
+
+    TaskGroup group;
+    for (size_t i = 1; i < workers_count; ++i)
+    {
+        run(group, process_chunks);
+    }
+
+    process_chunks();
+    wait(group);
+}
+
+bool ThreadPool::takeTask(const TaskGroup* group, Task& task)
+{
+    const size_t own_queue_index = currentThreadIndex();
+    for (size_t offset = 0; offset < queues_.size(); ++offset)
+    {
+        TaskQueue& queue = *queues_[(own_queue_index + offset) % queues_.size()];
+        std::unique_lock lock(queue.mutex);
+
+        const auto matches = [&group](const Task& queued_task)
+        {
+            return group == nullptr || queued_task.group == group;
+        };
+
+        auto found_task = queue.tasks.end();
+        if (offset == 0)
+        {
+            // Run the most recent tasks of the own queue first, their data is more likely to be in the cache
+            const auto found_reverse_task = std::find_if(queue.tasks.rbegin(), queue.tasks.rend(), matches);
+            if (found_reverse_task != queue.tasks.rend())
+            {
+                found_task = std::prev(found_reverse_task.base());
+            }
+        }
+        else
+        {
+            found_task = std::find_if(queue.tasks.begin(), queue.tasks.end(), matches);
+        }
+
+        if (found_task != queue.tasks.end())
+        {
+            task = std::move(*found_task);
+            queue.tasks.erase(found_task);
+            lock.unlock();
+
+            --task.group->queued_tasks_;
+            std::lock_guard global_lock(mutex_);
+            --queued_tasks_;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::runTask(Task& task)
+{
+    task.function();
+
+    // The group may be destroyed as soon as its last task is done, so don't use it afterwards
+    if (--task.group->pending_tasks_ == 0)
+    {
+        {
+            std::lock_guard lock(mutex_);
+        }
+        done_condition_.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(const size_t thread_index)
+{
+    current_pool_ = this;
+    current_thread_index_ = thread_index;
+
+    while (true)
+    {
+        Task task;
+        if (takeTask(nullptr, task))
+        {
+            runTask(task);
+            continue;
+        }
+
+        std::unique_lock lock(mutex_);
+        wake_condition_.wait(
+            lock,
+            [this]()
+            {
+                return shutdown_ || queued_tasks_ > 0;
+            });
+        if (shutdown_)
+        {
+            return;
+        }
+    }
+}
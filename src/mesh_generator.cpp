@@ -0,0 +1,440 @@
+#include "mesh_generator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <random>
+
+#include <spdlog/spdlog.h>
+
+#include "ThreadPool.h"
+
+
+namespace mesh_generator
+{
+
+namespace
+{
+
+/*!
+ * @return A random number in the [0,1) range. The raw generator output is used rather than a distribution, whose implementation is not the same on
+ *         all platforms, so that the meshes are identical everywhere.
+ */
+double randomUnit(std::mt19937& random_generator)
+{
+    return static_cast<double>(random_generator()) / (static_cast<double>(std::mt19937::max()) + 1.0);
+}
+
+/*!
+ * @return A pseudo-random value in the [0,1) range for the given lattice point of the noise
+ */
+double latticeValue(const int64_t x, const int64_t y, const uint32_t octave, const uint32_t seed)
+{
+    // splitmix64 finalizer, which gives well distributed values for close inputs
+    uint64_t hash = (static_cast<uint64_t>(x) * 0x9E3779B97F4A7C15ull) ^ (static_cast<uint64_t>(y) * 0xC2B2AE3D27D4EB4Full)
+                  ^ ((static_cast<uint64_t>(octave) << 32) | seed);
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    hash ^= hash >> 31;
+    return static_cast<double>(hash >> 11) / static_cast<double>(1ull << 53);
+}
+
+/*!
+ * @return A fractal value noise at the given position, in the [0,1) range
+ */
+double fractalNoise(const double x, const double y, const uint32_t seed)
+{
+    constexpr uint32_t octaves_count = 6;
+
+    double value = 0.0;
+    double amplitude = 0.5;
+    double frequency = 1.0;
+    double total_amplitude = 0.0;
+    for (uint32_t octave = 0; octave < octaves_count; ++octave)
+    {
+        const double scaled_x = x * frequency;
+        const double scaled_y = y * frequency;
+        const double floor_x = std::floor(scaled_x);
+        const double floor_y = std::floor(scaled_y);
+        const auto cell_x = static_cast<int64_t>(floor_x);
+        const auto cell_y = static_cast<int64_t>(floor_y);
+
+        // Smoothstep interpolation between the lattice values, so that the surface has no visible creases
+        const double fraction_x = scaled_x - floor_x;
+        const double fraction_y = scaled_y - floor_y;
+        const double weight_x = fraction_x * fraction_x * (3.0 - (2.0 * fraction_x));
+        const double weight_y = fraction_y * fraction_y * (3.0 - (2.0 * fraction_y));
+        const double bottom = std::lerp(latticeValue(cell_x, cell_y, octave, seed), latticeValue(cell_x + 1, cell_y, octave, seed), weight_x);
+        const double top = std::lerp(latticeValue(cell_x, cell_y + 1, octave, seed), latticeValue(cell_x + 1, cell_y + 1, octave, seed), weight_x);
+
+        value += std::lerp(bottom, top, weight_y) * amplitude;
+        total_amplitude += amplitude;
+        amplitude *= 0.5;
+        frequency *= 2.0;
+    }
+
+    return value / total_amplitude;
+}
+
+/*!
+ * Adds a UV sphere, whose poles are on the Y axis
+ * @param mesh The mesh to add the sphere to
+ * @param center_x The X position of the center
+ * @param center_y The Y position of the center
+ * @param center_z The Z position of the center
+ * @param radius The radius of the sphere
+ * @param rings_count The number of rings between the poles, the sphere then has 4 * rings_count * (rings_count - 1) faces
+ * @param bump_amplitude The relative amplitude of the bumps on the surface, 0 to make a smooth sphere
+ * @param bump_phase The angular offset of the bumps
+ */
+void appendSphere(
+    GeneratedMesh& mesh,
+    const double center_x,
+    const double center_y,
+    const double center_z,
+    const double radius,
+    const uint32_t rings_count,
+    const double bump_amplitude,
+    const double bump_phase)
+{
+    const uint32_t segments_count = rings_count * 2;
+    const auto first_vertex = static_cast<uint32_t>(mesh.vertices.size());
+
+    const auto add_vertex = [&](const double theta, const double phi)
+    {
+        const double bumped_radius = radius * (1.0 + (bump_amplitude * std::sin((7.0 * theta) + bump_phase) * std::sin((5.0 * phi) + bump_phase)));
+        mesh.vertices.emplace_back(
+            static_cast<float>(center_x + (bumped_radius * std::sin(theta) * std::cos(phi))),
+            static_cast<float>(center_y + (bumped_radius * std::cos(theta))),
+            static_cast<float>(center_z + (bumped_radius * std::sin(theta) * std::sin(phi))));
+    };
+
+    add_vertex(0.0, 0.0);
+    for (uint32_t ring = 1; ring < rings_count; ++ring)
+    {
+        const double theta = std::numbers::pi * ring / rings_count;
+        for (uint32_t segment = 0; segment < segments_count; ++segment)
+        {
+            add_vertex(theta, 2.0 * std::numbers::pi * segment / segments_count);
+        }
+    }
+    add_vertex(std::numbers::pi, 0.0);
+
+    const uint32_t north_pole = first_vertex;
+    const uint32_t south_pole = first_vertex + 1 + ((rings_count - 1) * segments_count);
+    const auto ring_vertex = [&](const uint32_t ring, const uint32_t segment)
+    {
+        return first_vertex + 1 + ((ring - 1) * segments_count) + (segment % segments_count);
+    };
+
+    for (uint32_t segment = 0; segment < segments_count; ++segment)
+    {
+        mesh.faces.push_back(Face{ north_pole, ring_vertex(1, segment + 1), ring_vertex(1, segment) });
+        for (uint32_t ring = 1; ring < rings_count - 1; ++ring)
+        {
+            mesh.faces.push_back(Face{ ring_vertex(ring, segment), ring_vertex(ring + 1, segment + 1), ring_vertex(ring + 1, segment) });
+            mesh.faces.push_back(Face{ ring_vertex(ring, segment), ring_vertex(ring, segment + 1), ring_vertex(ring + 1, segment + 1) });
+        }
+        mesh.faces.push_back(Face{ ring_vertex(rings_count - 1, segment), ring_vertex(rings_count - 1, segment + 1), south_pole });
+    }
+}
+
+/*!
+ * Adds a closed axis-aligned box
+ * @param mesh The mesh to add the box to
+ * @param min The minimum corner of the box
+ * @param max The maximum corner of the box
+ */
+void appendBox(GeneratedMesh& mesh, const std::array<double, 3>& min, const std::array<double, 3>& max)
+{
+    const auto first_vertex = static_cast<uint32_t>(mesh.vertices.size());
+    for (uint32_t corner = 0; corner < 8; ++corner)
+    {
+        mesh.vertices.emplace_back(
+            static_cast<float>(corner & 1 ? max[0] : min[0]),
+            static_cast<float>(corner & 2 ? max[1] : min[1]),
+            static_cast<float>(corner & 4 ? max[2] : min[2]));
+    }
+
+    // Corners of each side, counter-clockwise when seen from the outside
+    constexpr std::array<std::array<uint32_t, 4>, 6> sides = { { { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 } } };
+    for (const std::array<uint32_t, 4>& side : sides)
+    {
+        mesh.faces.push_back(Face{ first_vertex + side[0], first_vertex + side[1], first_vertex + side[2] });
+        mesh.faces.push_back(Face{ first_vertex + side[0], first_vertex + side[2], first_vertex + side[3] });
+    }
+}
+
+void generateSphere(GeneratedMesh& mesh, const GeneratorOptions& options)
+{
+    const auto rings_count = static_cast<uint32_t>(std::max(2.0, std::round(std::sqrt(static_cast<double>(options.faces_count) / 4.0))));
+    mesh.vertices.reserve(2 + (static_cast<size_t>(rings_count - 1) * rings_count * 2));
+    mesh.faces.reserve(static_cast<size_t>(rings_count) * (rings_count - 1) * 4);
+    appendSphere(mesh, 0.0, 0.0, 0.0, 1.0, rings_count, 0.0, 0.0);
+}
+
+void generateTerrain(GeneratedMesh& mesh, const GeneratorOptions& options, ThreadPool& thread_pool)
+{
+    constexpr double noise_scale = 8.0;
+    constexpr double height_scale = 0.3;
+
+    const auto cells_count = static_cast<uint32_t>(std::max(1.0, std::round(std::sqrt(static_cast<double>(options.faces_count) / 2.0))));
+    const uint32_t side_vertices_count = cells_count + 1;
+    mesh.vertices.reserve(static_cast<size_t>(side_vertices_count) * side_vertices_count);
+    mesh.faces.reserve(static_cast<size_t>(cells_count) * cells_count * 2);
+
+    // The noise is the expensive part, so calculate it in parallel
+    std::vector<float> heights(static_cast<size_t>(side_vertices_count) * side_vertices_count);
+    thread_pool.parallelFor(
+        side_vertices_count,
+        1,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t row = begin; row < end; ++row)
+            {
+                const double y = static_cast<double>(row) / cells_count;
+                for (uint32_t column = 0; column < side_vertices_count; ++column)
+                {
+                    const double x = static_cast<double>(column) / cells_count;
+                    heights[(row * side_vertices_count) + column] = static_cast<float>(fractalNoise(x * noise_scale, y * noise_scale, options.seed) * height_scale);
+                }
+            }
+        });
+
+    for (uint32_t row = 0; row < side_vertices_count; ++row)
+    {
+        for (uint32_t column = 0; column < side_vertices_count; ++column)
+        {
+            mesh.vertices.emplace_back(
+                static_cast<float>(static_cast<double>(column) / cells_count),
+                heights[(static_cast<size_t>(row) * side_vertices_count) + column],
+                static_cast<float>(static_cast<double>(row) / cells_count));
+        }
+    }
+
+    for (uint32_t row = 0; row < cells_count; ++row)
+    {
+        for (uint32_t column = 0; column < cells_count; ++column)
+        {
+            const uint32_t corner00 = (row * side_vertices_count) + column;
+            const uint32_t corner01 = corner00 + 1;
+            const uint32_t corner10 = corner00 + side_vertices_count;
+            const uint32_t corner11 = corner10 + 1;
+            mesh.faces.push_back(Face{ corner00, corner10, corner11 });
+            mesh.faces.push_back(Face{ corner00, corner11, corner01 });
+        }
+    }
+}
+
+void generateLattice(GeneratedMesh& mesh, const GeneratorOptions& options)
+{
+    constexpr double beam_half_width = 0.05;
+    constexpr size_t beam_faces_count = 12;
+
+    // Each axis has cells * (cells + 1)^2 beams
+    const auto cells_count = static_cast<uint32_t>(std::max(1.0, std::round(std::cbrt(static_cast<double>(options.faces_count) / (beam_faces_count * 3)))));
+    const size_t beams_count = static_cast<size_t>(cells_count) * (cells_count + 1) * (cells_count + 1) * 3;
+    mesh.vertices.reserve(beams_count * 8);
+    mesh.faces.reserve(beams_count * beam_faces_count);
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        for (uint32_t i = 0; i < cells_count; ++i)
+        {
+            for (uint32_t j = 0; j <= cells_count; ++j)
+            {
+                for (uint32_t k = 0; k <= cells_count; ++k)
+                {
+                    std::array<double, 3> min;
+                    std::array<double, 3> max;
+                    // The beams stop before the nodes, so that they don't share any vertex position
+                    min[axis] = i + beam_half_width;
+                    max[axis] = i + 1 - beam_half_width;
+                    min[(axis + 1) % 3] = j - beam_half_width;
+                    max[(axis + 1) % 3] = j + beam_half_width;
+                    min[(axis + 2) % 3] = k - beam_half_width;
+                    max[(axis + 2) % 3] = k + beam_half_width;
+                    appendBox(mesh, min, max);
+                }
+            }
+        }
+    }
+}
+
+void generateIslands(GeneratedMesh& mesh, const GeneratorOptions& options)
+{
+    constexpr uint32_t island_rings_count = 4;
+    constexpr size_t island_faces_count = island_rings_count * (island_rings_count - 1) * 4;
+    constexpr size_t island_vertices_count = 2 + ((island_rings_count - 1) * island_rings_count * 2);
+
+    const size_t islands_count = std::max(size_t(1), options.faces_count / island_faces_count);
+    const double space_size = std::cbrt(static_cast<double>(islands_count)) * 4.0;
+    mesh.vertices.reserve(islands_count * island_vertices_count);
+    mesh.faces.reserve(islands_count * island_faces_count);
+
+    std::mt19937 random_generator(options.seed);
+    for (size_t island = 0; island < islands_count; ++island)
+    {
+        const double center_x = randomUnit(random_generator) * space_size;
+        const double center_y = randomUnit(random_generator) * space_size;
+        const double center_z = randomUnit(random_generator) * space_size;
+        const double radius = 0.5 + (randomUnit(random_generator) * 0.5);
+        const double bump_phase = randomUnit(random_generator) * 2.0 * std::numbers::pi;
+        appendSphere(mesh, center_x, center_y, center_z, radius, island_rings_count, 0.2, bump_phase);
+    }
+}
+
+/*!
+ * Calculates the faces adjacency, by looking for each edge at the other faces around its first vertex
+ * @param mesh The mesh whose faces connectivity is to be filled
+ * @param thread_pool The threads to run the calculation on
+ */
+void calculateConnectivity(GeneratedMesh& mesh, ThreadPool& thread_pool)
+{
+    constexpr size_t grain_size = 16384;
+
+    // Make the list of faces around each vertex
+    std::vector<uint32_t> vertices_faces_offsets(mesh.vertices.size() + 1, 0);
+    for (const Face& face : mesh.faces)
+    {
+        for (const uint32_t vertex : { face.i1, face.i2, face.i3 })
+        {
+            ++vertices_faces_offsets[vertex + 1];
+        }
+    }
+    for (size_t vertex = 0; vertex < mesh.vertices.size(); ++vertex)
+    {
+        vertices_faces_offsets[vertex + 1] += vertices_faces_offsets[vertex];
+    }
+
+    std::vector<uint32_t> vertices_faces(mesh.faces.size() * 3);
+    std::vector<uint32_t> insert_offsets(vertices_faces_offsets.begin(), vertices_faces_offsets.end() - 1);
+    for (size_t face_index = 0; face_index < mesh.faces.size(); ++face_index)
+    {
+        const Face& face = mesh.faces[face_index];
+        for (const uint32_t vertex : { face.i1, face.i2, face.i3 })
+        {
+            vertices_faces[insert_offsets[vertex]++] = static_cast<uint32_t>(face_index);
+        }
+    }
+
+    const auto find_connected_face = [&](const uint32_t face_index, const uint32_t vertex1, const uint32_t vertex2) -> int32_t
+    {
+        for (uint32_t offset = vertices_faces_offsets[vertex1]; offset < vertices_faces_offsets[vertex1 + 1]; ++offset)
+        {
+            const uint32_t other_face_index = vertices_faces[offset];
+            const Face& other_face = mesh.faces[other_face_index];
+            if (other_face_index != face_index && (other_face.i1 == vertex2 || other_face.i2 == vertex2 || other_face.i3 == vertex2))
+            {
+                return static_cast<int32_t>(other_face_index);
+            }
+        }
+
+        return -1;
+    };
+
+    mesh.faces_connectivity.resize(mesh.faces.size());
+    thread_pool.parallelFor(
+        mesh.faces.size(),
+        grain_size,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t face_index = begin; face_index < end; ++face_index)
+            {
+                const Face& face = mesh.faces[face_index];
+                const auto face_index_32 = static_cast<uint32_t>(face_index);
+                mesh.faces_connectivity[face_index] = FaceSigned{ find_connected_face(face_index_32, face.i1, face.i2),
+                                                                  find_connected_face(face_index_32, face.i2, face.i3),
+                                                                  find_connected_face(face_index_32, face.i3, face.i1) };
+            }
+        });
+}
+
+/*!
+ * Gives each face its own vertices, the faces keep their indices so that the connectivity is still valid
+ * @param mesh The mesh to be converted
+ */
+void makeSoup(GeneratedMesh& mesh)
+{
+    std::vector<Point3F> soup_vertices;
+    soup_vertices.reserve(mesh.faces.size() * 3);
+    for (Face& face : mesh.faces)
+    {
+        const auto first_vertex = static_cast<uint32_t>(soup_vertices.size());
+        soup_vertices.push_back(mesh.vertices[face.i1]);
+        soup_vertices.push_back(mesh.vertices[face.i2]);
+        soup_vertices.push_back(mesh.vertices[face.i3]);
+        face = Face{ first_vertex, first_vertex + 1, first_vertex + 2 };
+    }
+
+    mesh.vertices = std::move(soup_vertices);
+}
+
+} // namespace
+
+GeneratedMesh generateMesh(const GeneratorOptions& options)
+{
+    GeneratedMesh mesh;
+
+    // The actual faces count may be a bit higher than the requested one, and a soup has 3 vertices per face
+    if (options.faces_count > std::numeric_limits<uint32_t>::max() / 4)
+    {
+        spdlog::error("Can't generate a mesh of {} faces, which would be too big to be indexed", options.faces_count);
+        return mesh;
+    }
+
+    ThreadPool thread_pool;
+    switch (options.shape)
+    {
+    case Shape::Sphere:
+        generateSphere(mesh, options);
+        break;
+    case Shape::Terrain:
+        generateTerrain(mesh, options, thread_pool);
+        break;
+    case Shape::Lattice:
+        generateLattice(mesh, options);
+        break;
+    case Shape::Islands:
+        generateIslands(mesh, options);
+        break;
+    }
+
+    if (options.with_connectivity)
+    {
+        calculateConnectivity(mesh, thread_pool);
+    }
+
+    if (options.soup)
+    {
+        makeSoup(mesh);
+    }
+
+    return mesh;
+}
+
+std::optional<Shape> shapeFromName(const std::string_view& name)
+{
+    if (name == "sphere")
+    {
+        return Shape::Sphere;
+    }
+    if (name == "terrain")
+    {
+        return Shape::Terrain;
+    }
+    if (name == "lattice")
+    {
+        return Shape::Lattice;
+    }
+    if (name == "islands")
+    {
+        return Shape::Islands;
+    }
+
+    return std::nullopt;
+}
+
+}; // namespace mesh_generator
@@ -2,6 +2,7 @@
 
 #include "project.h"
 
+#include <iterator>
 #include <polyclipping/clipper.hpp>
 #include <unordered_set>
 
@@ -10,6 +11,7 @@
 #include "Matrix44F.h"
 #include "Point2F.h"
 #include "Point3F.h"
+#include "ThreadPool.h"
 #include "Triangle2F.h"
 #include "Triangle3F.h"
 #include "Vector2F.h"
@@ -168,30 +170,23 @@ std::vector<Polygon> doProject(
     const uint32_t viewport_width,
     const uint32_t viewport_height,
     const Vector3F& camera_normal,
-    const uint32_t face_id)
+    const uint32_t face_id,
+    ThreadPool* shared_thread_pool)
 {
-    std::vector<Polygon> result;
     const ClipperLib::Path stroke_polygon_path = toPath(stroke_polygon);
 
-    std::unordered_set<uint32_t> candidate_faces{ face_id };
-    std::unordered_set<uint32_t> processed_faces;
-
-    while (! candidate_faces.empty())
+    // Projects the stroke onto the given face, and fills the polygons with the UV areas it covers. Returns true if the stroke intersects the face, in
+    // which case it may also intersect the adjacent faces.
+    const auto project_face = [&](const uint32_t face_index, std::vector<Polygon>& polygons) -> bool
     {
-        auto iterator = candidate_faces.begin();
-        const uint32_t candidate_face_id = *iterator;
-        candidate_faces.erase(iterator);
-
-        processed_faces.insert(candidate_face_id);
-
-        const Face face = getFace(mesh_indices, candidate_face_id);
+        const Face face = getFace(mesh_indices, face_index);
         const Triangle3F face_triangle = getFaceTriangle(mesh_vertices, face);
         const Vector3F face_normal = face_triangle.normal();
 
         if (face_normal.dot(camera_normal) < 0)
         {
             // Facing away from the viewer
-            continue;
+            return false;
         }
 
         const Triangle2F projected_face_triangle = projectToViewport(face_triangle, camera_projection_matrix, is_camera_perspective, viewport_width, viewport_height);
@@ -201,7 +196,7 @@ std::vector<Polygon> doProject(
 
         if (uv_areas.empty())
         {
-            continue;
+            return false;
         }
 
         const Triangle2F face_uv = getFaceUv(mesh_uv, face);
@@ -220,17 +215,60 @@ std::vector<Polygon> doProject(
                 result_polygon.push_back(getTextureCoordinates(point, face_uv, texture_width, texture_height));
             }
 
-            result.push_back(std::move(result_polygon));
+            polygons.push_back(std::move(result_polygon));
         }
 
-        const FaceSigned& connected_faces = mesh_faces_connectivity[candidate_face_id];
-        for (const int32_t connected_face : { connected_faces.i1, connected_faces.i2, connected_faces.i3 })
+        return true;
+    };
+
+    // Propagate the stroke from the initial face to the adjacent faces, by processing all the faces of the current front in parallel
+    std::vector<Polygon> result;
+    std::vector<uint32_t> front_faces{ face_id };
+    std::unordered_set<uint32_t> reached_faces{ face_id };
+    std::vector<std::vector<Polygon>> front_faces_polygons;
+    std::vector<uint8_t> front_faces_propagate;
+
+    while (! front_faces.empty())
+    {
+        front_faces_polygons.assign(front_faces.size(), {});
+        front_faces_propagate.assign(front_faces.size(), false);
+        const auto project_front_faces = [&](const size_t begin, const size_t end)
         {
-            if (connected_face >= 0 && ! processed_faces.contains(connected_face))
+            for (size_t index = begin; index < end; ++index)
             {
-                candidate_faces.insert(connected_face);
+                front_faces_propagate[index] = project_face(front_faces[index], front_faces_polygons[index]);
             }
+        };
+
+        if (shared_thread_pool)
+        {
+            shared_thread_pool->parallelFor(front_faces.size(), 8, project_front_faces);
         }
+        else
+        {
+            // Without a shared pool, run on the calling thread only
+            project_front_faces(0, front_faces.size());
+        }
+
+        std::vector<uint32_t> next_front_faces;
+        for (size_t index = 0; index < front_faces.size(); ++index)
+        {
+            std::move(front_faces_polygons[index].begin(), front_faces_polygons[index].end(), std::back_inserter(result));
+
+            if (front_faces_propagate[index])
+            {
+                const FaceSigned& connected_faces = mesh_faces_connectivity[front_faces[index]];
+                for (const int32_t connected_face : { connected_faces.i1, connected_faces.i2, connected_faces.i3 })
+                {
+                    if (connected_face >= 0 && reached_faces.insert(connected_face).second)
+                    {
+                        next_front_faces.push_back(connected_face);
+                    }
+                }
+            }
+        }
+
+        front_faces = std::move(next_front_faces);
     }
 
     ClipperLib::Paths uv_areas_path;
@@ -3,36 +3,46 @@
 #include "unwrap.h"
 
 #include <algorithm>
-#include <map>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
-#include <set>
+#include <random>
 
 #include <range/v3/algorithm/partition.hpp>
 #include <range/v3/view/enumerate.hpp>
 #include <range/v3/view/map.hpp>
 #include <spdlog/spdlog.h>
+#include <spdlog/stopwatch.h>
 
+#include "Charts.h"
+#include "FacesData.h"
 #include "Matrix33F.h"
 #include "Point2F.h"
 #include "Point3F.h"
+#include "ThreadPool.h"
 #include "Vector3F.h"
 #include "geometry_utils.h"
+#include "unwrap_stages.h"
 #include "xatlas.h"
 
 
-struct FaceData
-{
-    const Face* face;
-    size_t face_index;
-    Vector3F normal;
-};
-
 /*!
- * Calculate the best projection normals according to the given input faces
- * @param faces_data The faces data
- * @return A list of normals that are far enough from each other
+ * @param timer The timer measuring the current stage, which is restarted for the next one
+ * @return The number of milliseconds elapsed since the timer was started
  */
-std::vector<Vector3F> calculateProjectionNormals(const std::vector<FaceData>& faces_data)
+static double lapDuration(spdlog::stopwatch& timer)
+{
+    const double duration = std::chrono::duration<double, std::milli>(timer.elapsed()).count();
+    timer.reset();
+    return duration;
+}
+
+std::vector<Vector3F> calculateProjectionNormals(const FacesData& faces_data, ThreadPool& thread_pool)
 {
     constexpr float group_angle_limit = 20.0;
 
@@ -40,88 +50,105 @@ std::vector<Vector3F> calculateProjectionNormals(const std::vector<FaceData>& fa
     const float group_angle_limit_half_cos = std::cos(geometry_utils::deg2rad(group_angle_limit / 2));
 
     // First group will be based on the normal of the very first face
-    const Vector3F* project_normal = &faces_data.front().normal;
+    Vector3F project_normal = faces_data.normal(0);
 
     std::vector<Vector3F> projection_normals;
 
-    // Create an internal list containing pointers to all the faces data, it will be reorganized
-    std::vector<const FaceData*> faces_to_process(faces_data.size());
-    std::transform(
-        faces_data.begin(),
-        faces_data.end(),
-        faces_to_process.begin(),
-        [](const FaceData& face_data)
-        {
-            return &face_data;
-        });
+    // Work on a copy of the faces, which will be reorganized. Each face also caches the best dot product between its normal and the projection normals
+    // found so far, so that only the newly added normal has to be tested at each iteration.
+    FacesData faces = faces_data;
+    std::vector<float> best_angles(faces.size(), std::numeric_limits<float>::lowest());
+    std::vector<uint8_t> close_faces;
+    std::vector<uint32_t> faces_order;
+    std::vector<uint32_t> moved_faces_destinations;
+    std::vector<uint32_t> moved_faces_sources;
+    FacesData moved_faces_buffer;
+    std::vector<float> moved_best_angles;
 
-    using FaceDataIterator = std::vector<const FaceData*>::iterator;
-    struct FaceDataRange
-    {
-        FaceDataIterator begin;
-        FaceDataIterator end;
-    };
+    // The unprocessed faces are the end of the faces list, and contain all the faces that have not been assigned to a group yet
+    size_t unprocessed_faces_begin = 0;
 
-    // The unprocessed_faces is a sub-range of the faces list, that contains all the faces that have not been assigned to a group yet.
-    FaceDataRange unprocessed_faces = { .begin = faces_to_process.begin(), .end = faces_to_process.end() };
+    std::mutex best_outlier_mutex;
 
     while (true)
     {
-        // Get all the faces that belong to the group of the current projection normal,
-        // by placing them at the beginning of the unprocessed faces
-        FaceDataRange current_faces_group{ .begin = unprocessed_faces.begin };
-        current_faces_group.end = ranges::partition(
-            unprocessed_faces.begin,
-            unprocessed_faces.end,
-            [&project_normal, &group_angle_limit_half_cos](const FaceData* face_data)
+        // Get all the faces that belong to the group of the current projection normal, by placing them at the beginning of the unprocessed faces. The
+        // indices are partitioned rather than the faces, then only the faces that changed place are moved.
+        faces.findCloseFaces(project_normal, group_angle_limit_half_cos, unprocessed_faces_begin, faces.size(), close_faces, thread_pool);
+        faces_order.resize(faces.size() - unprocessed_faces_begin);
+        std::iota(faces_order.begin(), faces_order.end(), static_cast<uint32_t>(unprocessed_faces_begin));
+        const auto group_order_end = ranges::partition(
+            faces_order.begin(),
+            faces_order.end(),
+            [&close_faces, &unprocessed_faces_begin](const uint32_t face)
             {
-                return face_data->normal.dot(*project_normal) > group_angle_limit_half_cos;
+                return close_faces[face - unprocessed_faces_begin] != 0;
             });
+        moved_faces_destinations.clear();
+        moved_faces_sources.clear();
+        moved_best_angles.clear();
+        for (const auto& [order_index, face] : faces_order | ranges::views::enumerate)
+        {
+            const auto destination = static_cast<uint32_t>(unprocessed_faces_begin + order_index);
+            if (face != destination)
+            {
+                moved_faces_destinations.push_back(destination);
+                moved_faces_sources.push_back(face);
+                moved_best_angles.push_back(best_angles[face]);
+            }
+        }
+        faces.moveFaces(moved_faces_destinations, moved_faces_sources, moved_faces_buffer);
+        for (const auto& [moved_index, destination] : moved_faces_destinations | ranges::views::enumerate)
+        {
+            best_angles[destination] = moved_best_angles[moved_index];
+        }
 
         // All the faces placed to the current group are now no more in the unprocessed faces
-        unprocessed_faces.begin = current_faces_group.end;
+        const size_t current_faces_group_begin = unprocessed_faces_begin;
+        unprocessed_faces_begin += std::distance(faces_order.begin(), group_order_end);
 
         // Sum all the normals of the current faces group to get the average direction
-        Vector3F summed_normals = std::accumulate(
-            current_faces_group.begin,
-            current_faces_group.end,
-            Vector3F(),
-            [](const Vector3F& normal, const FaceData* face_data)
-            {
-                return normal + face_data->normal;
-            });
-        if (summed_normals.normalize()) [[likely]]
+        Vector3F summed_normals;
+        for (size_t index = current_faces_group_begin; index < unprocessed_faces_begin; ++index)
+        {
+            summed_normals = summed_normals + faces.normal(index);
+        }
+        const bool normal_added = summed_normals.normalize();
+        if (normal_added) [[likely]]
         {
             projection_normals.push_back(summed_normals);
         }
 
-        // For the next iteration, try to find the most different remaining normal from all generated normals
+        // For the next iteration, try to find the most different remaining normal from all generated normals. The cached best angles are updated
+        // with the new normal while searching, and each chunk reports its first lowest face so that the result doesn't depend on the threads timing.
         float best_outlier_angle = std::numeric_limits<float>::max();
-        FaceDataIterator best_outlier_face = faces_to_process.end();
+        size_t best_outlier_face = faces.size();
 
-        for (auto iterator = unprocessed_faces.begin; iterator != unprocessed_faces.end; ++iterator)
-        {
-            float face_best_angle = std::numeric_limits<float>::lowest();
-            for (const Vector3F& projection_normal : projection_normals)
+        thread_pool.parallelFor(
+            faces.size() - unprocessed_faces_begin,
+            16384,
+            [&](const size_t begin, const size_t end)
             {
-                face_best_angle = std::max(face_best_angle, projection_normal.dot((*iterator)->normal));
-            }
+                const auto [chunk_best_face, chunk_best_angle]
+                    = faces.raiseBestDots(normal_added ? &summed_normals : nullptr, best_angles, unprocessed_faces_begin + begin, unprocessed_faces_begin + end);
 
-            if (face_best_angle < best_outlier_angle)
-            {
-                best_outlier_angle = face_best_angle;
-                best_outlier_face = iterator;
-            }
-        }
+                std::lock_guard lock(best_outlier_mutex);
+                if (chunk_best_angle < best_outlier_angle || (chunk_best_angle == best_outlier_angle && chunk_best_face < best_outlier_face))
+                {
+                    best_outlier_angle = chunk_best_angle;
+                    best_outlier_face = chunk_best_face;
+                }
+            });
 
         if (best_outlier_angle < group_angle_limit_cos)
         {
             // Take the normal of the best outlier as the base for the iteration of the next group
-            project_normal = &(*best_outlier_face)->normal;
+            project_normal = faces.normal(best_outlier_face);
 
             // Remove the faces from the unprocessed faces
-            std::iter_swap(best_outlier_face, unprocessed_faces.begin);
-            ++unprocessed_faces.begin;
+            faces.swapFaces(best_outlier_face, unprocessed_faces_begin);
+            std::swap(best_angles[best_outlier_face], best_angles[unprocessed_faces_begin]);
+            ++unprocessed_faces_begin;
         }
         else if (! projection_normals.empty())
         {
@@ -132,251 +159,594 @@ std::vector<Vector3F> calculateProjectionNormals(const std::vector<FaceData>& fa
     return projection_normals;
 }
 
-static std::vector<FaceData> makeFacesData(const std::vector<Point3F>& vertices, const std::vector<Face>& faces)
+/*!
+ * Picks a subset of the faces, so that the projection normals can be estimated on huge meshes without clustering all their faces. Faces are picked by
+ * systematic sampling along their cumulated area, so that big faces are more likely to be picked than small ones, like they would weight more in the
+ * clustering. The random start uses a fixed seed, so that the same mesh always gives the same subset.
+ * @param faces_data The faces data to be sampled
+ * @param max_samples The maximum number of faces to be picked
+ * @param sampled_faces_data Output buffer filled with the picked faces data, in their original order. It is left empty if the faces could not be sampled
+ */
+static void sampleFacesData(const FacesData& faces_data, const size_t max_samples, FacesData& sampled_faces_data)
 {
-    std::vector<FaceData> faces_data;
-    faces_data.reserve(faces.size());
+    sampled_faces_data.clear();
+
+    std::vector<double> cumulated_areas(faces_data.area.begin(), faces_data.area.end());
+    std::inclusive_scan(cumulated_areas.begin(), cumulated_areas.end(), cumulated_areas.begin());
 
-    for (const auto& [index, face] : faces | ranges::views::enumerate)
+    const double total_area = cumulated_areas.back();
+    if (total_area <= 0.0) [[unlikely]]
     {
-        const Point3F& v1 = vertices[face.i1];
-        const Point3F& v2 = vertices[face.i2];
-        const Point3F& v3 = vertices[face.i3];
+        return;
+    }
+
+    // Use the raw generator output rather than a distribution, whose implementation is not the same on all platforms
+    std::mt19937 random_generator(5489u);
+    const double step = total_area / max_samples;
+    double position = step * (static_cast<double>(random_generator()) / (static_cast<double>(std::mt19937::max()) + 1.0));
 
-        const std::optional<Vector3F> triangle_normal = geometry_utils::triangleNormal(v1, v2, v3);
-        if (triangle_normal.has_value())
+    for (const auto& [index, cumulated_area] : cumulated_areas | ranges::views::enumerate)
+    {
+        if (position < cumulated_area)
         {
-            faces_data.push_back(FaceData{ &face, index, triangle_normal.value() });
+            // Faces bigger than the step may contain many positions, but they are picked only once
+            sampled_faces_data.face_index.push_back(faces_data.face_index[index]);
+            sampled_faces_data.normal_x.push_back(faces_data.normal_x[index]);
+            sampled_faces_data.normal_y.push_back(faces_data.normal_y[index]);
+            sampled_faces_data.normal_z.push_back(faces_data.normal_z[index]);
+            sampled_faces_data.area.push_back(faces_data.area[index]);
+            while (position < cumulated_area)
+            {
+                position += step;
+            }
         }
     }
-
-    return faces_data;
 }
 
-/*!
- * Groups the faces that have a similar normal, and project their points as raw UV coordinates along this normal
- * @param vertices The list of vertices positions
- * @param faces The list of faces we want to project
- * @param uv_coords The UV coordinates, which should be properly sized but the input content doesn't matter. As output, they will be filled with
- *                  raw UV coordinates that overlap and are not in the [0,1] range
- * @return A list containing grouped indices of faces
- */
-static std::vector<std::vector<size_t>> makeCharts(const std::vector<Point3F>& vertices, const std::vector<Face>& faces, std::vector<Point2F>& uv_coords)
+Charts makeCharts(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const std::span<Point2F>& uv_coords,
+    const size_t projection_normals_max_samples,
+    ThreadPool& thread_pool,
+    UnwrapScratch& scratch)
 {
-    const std::vector<FaceData> faces_data = makeFacesData(vertices, faces);
-    if (faces_data.empty()) [[unlikely]]
+    FacesData& faces_data = scratch.faces_data;
+    faces_data.fill(vertices, faces, thread_pool);
+    if (faces_data.size() == 0) [[unlikely]]
     {
         return {};
     }
 
-    // Calculate the best normals to group the faces
-    const std::vector<Vector3F> project_normal_array = calculateProjectionNormals(faces_data);
+    // Calculate the best normals to group the faces, possibly on a subset of them, but all the faces will be assigned to a group anyway
+    FacesData& sampled_faces_data = scratch.sampled_faces_data;
+    sampled_faces_data.clear();
+    if (projection_normals_max_samples > 0 && faces_data.size() > projection_normals_max_samples)
+    {
+        sampleFacesData(faces_data, projection_normals_max_samples, sampled_faces_data);
+    }
+    const std::vector<Vector3F> project_normal_array
+        = calculateProjectionNormals(sampled_faces_data.size() == 0 ? faces_data : sampled_faces_data, thread_pool);
     if (project_normal_array.empty()) [[unlikely]]
     {
         return {};
     }
 
-    // For each face, find the best projection normal and make groups
-    std::map<const Vector3F*, std::vector<const FaceData*>> projected_faces_groups;
-    for (const FaceData& face_data : faces_data)
-    {
-        const Vector3F* best_projection_normal = nullptr;
-        float angle_best = std::numeric_limits<float>::lowest();
-
-        for (const Vector3F& projection_normal : project_normal_array)
+    // For each face, find the best projection normal
+    std::vector<uint32_t>& best_normals = scratch.best_normals;
+    faces_data.findBestNormals(project_normal_array, best_normals, thread_pool);
+
+    // Counting sort of the faces by projection normal into a contiguous buffer, which keeps the faces ordered by index inside a group
+    constexpr size_t grain_size = 16384;
+    const size_t normals_count = project_normal_array.size();
+    const size_t blocks_count = (faces_data.size() + grain_size - 1) / grain_size;
+    std::vector<uint32_t>& blocks_histograms = scratch.blocks_histograms;
+    blocks_histograms.assign(blocks_count * normals_count, 0);
+    thread_pool.parallelFor(
+        blocks_count,
+        1,
+        [&](const size_t begin, const size_t end)
         {
-            const float angle = face_data.normal.dot(projection_normal);
-            if (angle > angle_best)
+            for (size_t block = begin; block < end; ++block)
             {
-                angle_best = angle;
-                best_projection_normal = &projection_normal;
+                uint32_t* histogram = &blocks_histograms[block * normals_count];
+                for (size_t index = block * grain_size; index < std::min((block + 1) * grain_size, faces_data.size()); ++index)
+                {
+                    ++histogram[best_normals[index]];
+                }
             }
-        }
+        });
 
-        projected_faces_groups[best_projection_normal].push_back(&face_data);
+    std::vector<uint32_t> groups_offsets(normals_count + 1, 0);
+    uint32_t offset = 0;
+    for (size_t normal_index = 0; normal_index < normals_count; ++normal_index)
+    {
+        groups_offsets[normal_index] = offset;
+        for (size_t block = 0; block < blocks_count; ++block)
+        {
+            uint32_t& count = blocks_histograms[block * normals_count + normal_index];
+            const uint32_t block_count = count;
+            count = offset; // The histogram now contains the insertion offset of the block
+            offset += block_count;
+        }
     }
+    groups_offsets[normals_count] = offset;
+
+    // The groups are stored one after the other, so this is directly the faces list of the charts, empty groups having no faces
+    Charts charts;
+    std::vector<uint32_t>& grouped_faces = charts.faces;
+    grouped_faces.resize(faces_data.size());
+    thread_pool.parallelFor(
+        blocks_count,
+        1,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t block = begin; block < end; ++block)
+            {
+                uint32_t* insert_offsets = &blocks_histograms[block * normals_count];
+                for (size_t index = block * grain_size; index < std::min((block + 1) * grain_size, faces_data.size()); ++index)
+                {
+                    grouped_faces[insert_offsets[best_normals[index]]++] = faces_data.face_index[index];
+                }
+            }
+        });
 
     // Now project each faces according to the closest matching normal and create indices groups
-    std::vector<std::vector<size_t>> grouped_faces_indices;
-    for (const auto& [normal, faces_data] : projected_faces_groups)
+    charts.offsets.reserve(normals_count + 1);
+    for (size_t normal_index = 0; normal_index < normals_count; ++normal_index)
     {
-        const Matrix33F axis_mat = Matrix33F::makeOrthogonalBasis(*normal);
-        std::vector<size_t> faces_group;
-        faces_group.reserve(faces_data.size());
-
-        for (const FaceData* face_from_group : faces_data)
+        const auto group_begin = grouped_faces.begin() + groups_offsets[normal_index];
+        const auto group_end = grouped_faces.begin() + groups_offsets[normal_index + 1];
+        if (group_begin == group_end)
         {
-            faces_group.push_back(face_from_group->face_index);
+            continue;
+        }
 
-            for (const uint32_t vertex_index : { face_from_group->face->i1, face_from_group->face->i2, face_from_group->face->i3 })
+        const Matrix33F axis_mat = Matrix33F::makeOrthogonalBasis(project_normal_array[normal_index]);
+        for (auto iterator = group_begin; iterator != group_end; ++iterator)
+        {
+            const Face& face = faces[*iterator];
+            for (const uint32_t vertex_index : { face.i1, face.i2, face.i3 })
             {
                 uv_coords[vertex_index] = axis_mat.project(vertices[vertex_index]);
             }
         }
 
-        grouped_faces_indices.push_back(std::move(faces_group));
+        charts.offsets.push_back(groups_offsets[normal_index + 1]);
     }
 
-    return grouped_faces_indices;
+    return charts;
 }
 
 /*!
- * When projecting faces groups along a normal, it is possible that we project faces that are actually far away from each other spatially. This sometimes
- * results in overlapping projections, which we really want to avoid. The purpose of this function is to make sub-groups of faces groups for faces that are
- * adjacent to each other.
- * @param grouped_faces Contains the grouped indices of faces
- * @param faces The actual faces definitions, whose vertices should have been merged before, @sa groupSimilarVertices()
- * @return Grouped faces with groups containing only adjacent faces. It may be identical to the original groups, or contain more smaller groups
+ * Disjoint-set of the faces of a group, in which the representative of a set is always its smallest face index
  */
-std::vector<std::vector<size_t>> splitNonLinkedFacesCharts(const std::vector<std::vector<size_t>>& grouped_faces, const std::vector<Face>& faces)
+class FacesDisjointSet
 {
-    std::vector<std::vector<size_t>> result;
+public:
+    void reset(const size_t faces_count)
+    {
+        parents_.resize(faces_count);
+        std::iota(parents_.begin(), parents_.end(), 0);
+    }
 
-    struct AssignedVertex
+    uint32_t find(uint32_t face)
     {
-        uint32_t index;
-        bool assigned;
-    };
+        while (parents_[face] != face)
+        {
+            // Path halving, which flattens the tree while searching for the root
+            parents_[face] = parents_[parents_[face]];
+            face = parents_[face];
+        }
+        return face;
+    }
 
-    for (const std::vector<size_t>& faces_group : grouped_faces)
+    void unite(const uint32_t face1, const uint32_t face2)
     {
-        size_t max_group_index = 0; // Incrementing group index
+        const uint32_t root1 = find(face1);
+        const uint32_t root2 = find(face2);
+        if (root1 < root2)
+        {
+            parents_[root2] = root1;
+        }
+        else if (root2 < root1)
+        {
+            parents_[root1] = root2;
+        }
+    }
 
-        // Keep a double cache so that we can find very quickly the group of a vertex, and all the vertices from a group
-        std::map<size_t, size_t> new_indices_groups; // vertex_index: group_index
-        std::map<size_t, std::set<size_t>> new_groups_vertices; // group_index: [vertex_index]
+private:
+    std::vector<uint32_t> parents_;
+};
 
-        for (const size_t face_index : faces_group)
+/*!
+ * Open-addressing table giving the first face of a group that used each vertex. It is sized to the group rather than to the mesh, and grows when it gets
+ * half full.
+ */
+class VerticesFirstFace
+{
+public:
+    void reset(const size_t faces_count)
+    {
+        // Once welded, a group usually has about half as many vertices as faces, so it rarely has to grow
+        assign(std::bit_ceil(std::max<size_t>(faces_count * 2, 16)));
+        vertices_count_ = 0;
+    }
+
+    /*!
+     * @return The first face registered for the vertex, which is the given face if the vertex wasn't registered yet
+     */
+    uint32_t findOrInsert(const uint32_t vertex, const uint32_t face)
+    {
+        uint64_t& slot = findSlot(vertex);
+        if (slot != empty_slot)
+        {
+            return static_cast<uint32_t>(slot);
+        }
+
+        slot = (static_cast<uint64_t>(vertex) << 32) | face;
+        if (++vertices_count_ * 2 > slots_.size())
         {
-            const Face& face = faces[face_index];
-            std::set<size_t> assigned_groups;
-            std::array<AssignedVertex, 3> assigned_vertices = { AssignedVertex{ .index = face.i1 }, AssignedVertex{ .index = face.i2 }, AssignedVertex{ .index = face.i3 } };
-            for (AssignedVertex& assigned_vertex : assigned_vertices)
+            grow();
+        }
+        return face;
+    }
+
+private:
+    static constexpr uint64_t empty_slot = std::numeric_limits<uint64_t>::max();
+
+    // Each slot holds a vertex in its high half and its first face in its low half
+    std::vector<uint64_t> slots_;
+    std::vector<uint64_t> previous_slots_;
+    int slots_shift_{ 0 };
+    size_t vertices_count_{ 0 };
+
+    void assign(const size_t slots_count)
+    {
+        slots_.assign(slots_count, empty_slot);
+        slots_shift_ = 64 - std::countr_zero(slots_count);
+    }
+
+    uint64_t& findSlot(const uint32_t vertex)
+    {
+        const size_t slots_mask = slots_.size() - 1;
+        for (size_t slot = (vertex * 0x9E3779B97F4A7C15ULL) >> slots_shift_;; slot = (slot + 1) & slots_mask)
+        {
+            if (slots_[slot] == empty_slot || (slots_[slot] >> 32) == vertex)
             {
-                auto iterator = new_indices_groups.find(assigned_vertex.index);
-                assigned_vertex.assigned = iterator != new_indices_groups.end();
-                if (assigned_vertex.assigned)
-                {
-                    assigned_groups.insert(iterator->second);
-                }
+                return slots_[slot];
             }
+        }
+    }
 
-            if (assigned_groups.empty())
+    void grow()
+    {
+        slots_.swap(previous_slots_);
+        assign(previous_slots_.size() * 2);
+        for (const uint64_t slot : previous_slots_)
+        {
+            if (slot != empty_slot)
             {
-                // None of the points are assigned yet, just assign them to a new group
-                const size_t new_group_index = max_group_index++;
-                new_indices_groups[face.i1] = new_group_index;
-                new_indices_groups[face.i2] = new_group_index;
-                new_indices_groups[face.i3] = new_group_index;
-                new_groups_vertices[new_group_index] = { face.i1, face.i2, face.i3 };
+                findSlot(static_cast<uint32_t>(slot >> 32)) = slot;
             }
-            else
-            {
-                const size_t target_group = *assigned_groups.begin();
-                std::set<size_t>& target_group_vertices = new_groups_vertices[target_group];
+        }
+    }
+};
+
+Charts splitNonLinkedFacesCharts(
+    const Charts& grouped_faces,
+    const std::span<const Face>& faces,
+    ThreadPool& thread_pool)
+{
 
-                std::set<size_t> source_groups = assigned_groups;
-                source_groups.erase(source_groups.begin());
+    // Process the biggest groups first, so that a big group doesn't end up being processed alone at the end
+    std::vector<size_t> groups_order(grouped_faces.size());
+    std::iota(groups_order.begin(), groups_order.end(), 0);
+    std::stable_sort(
+        groups_order.begin(),
+        groups_order.end(),
+        [&grouped_faces](const size_t group1, const size_t group2)
+        {
+            return grouped_faces[group1].size() > grouped_faces[group2].size();
+        });
+
+    // The sub-groups of a group take the place of the group in the faces list, so each group can be split on its own. As a group has at most one
+    // sub-group per face, the offsets of its sub-groups are also stored in the place of its faces until they are gathered.
+    Charts result;
+    result.faces.resize(grouped_faces.faces.size());
+    std::vector<uint32_t> sub_groups_offsets(grouped_faces.faces.size());
+    std::vector<uint32_t> sub_groups_counts(grouped_faces.size());
+    std::atomic<size_t> next_group{ 0 };
+    const size_t workers_count = std::min(thread_pool.threadCount(), grouped_faces.size());
+
+    thread_pool.parallelFor(
+        workers_count,
+        1,
+        [&](const size_t /*begin*/, const size_t /*end*/)
+        {
+            VerticesFirstFace vertices_first_face;
+            FacesDisjointSet faces_sets;
+            std::vector<uint32_t> faces_sub_group;
+            std::vector<uint32_t> sub_groups_insert_offsets;
 
-                // First assign vertices that are not assigned yet
-                for (const AssignedVertex& assigned_vertex : assigned_vertices)
+            for (size_t order_index = next_group++; order_index < groups_order.size(); order_index = next_group++)
+            {
+                const size_t group_index = groups_order[order_index];
+                const uint32_t group_offset = grouped_faces.offsets[group_index];
+                const std::span<const uint32_t> faces_group = grouped_faces[group_index];
+
+                // Link each face to the first face that used each of its vertices
+                vertices_first_face.reset(faces_group.size());
+                faces_sets.reset(faces_group.size());
+                for (const auto& [local_face_index, face_index] : faces_group | ranges::views::enumerate)
                 {
-                    if (! assigned_vertex.assigned)
+                    const Face& face = faces[face_index];
+                    for (const uint32_t vertex_index : { face.i1, face.i2, face.i3 })
                     {
-                        new_indices_groups[assigned_vertex.index] = target_group;
-                        target_group_vertices.insert(assigned_vertex.index);
+                        const uint32_t first_face = vertices_first_face.findOrInsert(vertex_index, local_face_index);
+                        if (first_face != local_face_index)
+                        {
+                            faces_sets.unite(first_face, local_face_index);
+                        }
                     }
                 }
 
-                // Now merge source groups to the target group, including actually processed vertices
-                for (const size_t source_group : source_groups)
+                // The root of a set is its first face, so sub-groups get numbered in the order of their first face
+                faces_sub_group.resize(faces_group.size());
+                sub_groups_insert_offsets.clear();
+                for (uint32_t local_face_index = 0; local_face_index < faces_group.size(); ++local_face_index)
                 {
-                    auto it_source_group = new_groups_vertices.find(source_group);
-                    for (const size_t vertex_from_source_group : it_source_group->second)
+                    const uint32_t root = faces_sets.find(local_face_index);
+                    if (root == local_face_index)
+                    {
+                        faces_sub_group[local_face_index] = sub_groups_insert_offsets.size();
+                        sub_groups_insert_offsets.push_back(0);
+                    }
+                    else
                     {
-                        size_t& vertex_group = new_indices_groups[vertex_from_source_group];
-                        vertex_group = target_group;
-                        target_group_vertices.insert(vertex_from_source_group);
+                        faces_sub_group[local_face_index] = faces_sub_group[root];
                     }
+                    ++sub_groups_insert_offsets[faces_sub_group[local_face_index]];
+                }
 
-                    new_groups_vertices.erase(it_source_group);
+                // Turn the sizes of the sub-groups into their offsets, then distribute the faces, which keeps them in their original order
+                uint32_t offset = group_offset;
+                for (size_t sub_group_index = 0; sub_group_index < sub_groups_insert_offsets.size(); ++sub_group_index)
+                {
+                    const uint32_t sub_group_size = sub_groups_insert_offsets[sub_group_index];
+                    sub_groups_insert_offsets[sub_group_index] = offset;
+                    sub_groups_offsets[group_offset + sub_group_index] = offset;
+                    offset += sub_group_size;
+                }
+                for (const auto& [local_face_index, face_index] : faces_group | ranges::views::enumerate)
+                {
+                    result.faces[sub_groups_insert_offsets[faces_sub_group[local_face_index]]++] = face_index;
                 }
+                sub_groups_counts[group_index] = sub_groups_insert_offsets.size();
             }
-        }
-
-        std::map<size_t, std::vector<size_t>> new_faces_groups; // group_index: [face_index]
-        for (const size_t face_index : faces_group)
-        {
-            const Face& face = faces[face_index];
-            new_faces_groups[new_indices_groups[face.i1]].push_back(face_index);
-        }
+        });
 
-        for (const std::vector<size_t>& faces_indices : new_faces_groups | ranges::views::values)
-        {
-            result.push_back(faces_indices);
-        }
+    result.offsets.clear();
+    result.offsets.reserve(std::accumulate(sub_groups_counts.begin(), sub_groups_counts.end(), size_t(1)));
+    for (size_t group_index = 0; group_index < grouped_faces.size(); ++group_index)
+    {
+        const auto group_sub_groups_offsets = sub_groups_offsets.begin() + grouped_faces.offsets[group_index];
+        result.offsets.insert(result.offsets.end(), group_sub_groups_offsets, group_sub_groups_offsets + sub_groups_counts[group_index]);
     }
+    result.offsets.push_back(result.faces.size());
 
     return result;
 }
 
 /*!
- * When loading the mesh, each vertex of each triangle is given a unique index, even if it is used in multiple adjacent triangles. The purpose
- * of this function is to remove double vertices so that we can make adjacency detection easier.
- * @param faces The original list of faces
- * @param vertices The original list of vertices position
- * @return The modified list of faces, which contains as many faces but with merged vertices
+ * Key identifying a vertex position for welding: either the raw bits of the coordinates, or the coordinates snapped to a grid
  */
-std::vector<Face> groupSimilarVertices(const std::vector<Face>& faces, const std::vector<Point3F>& vertices)
+struct WeldKey
 {
-    std::vector<Face> faces_with_similar_indices;
-    std::map<Point3F, size_t> unique_vertices_indices;
-    std::vector<uint32_t> new_vertices_indices(vertices.size());
+    int64_t x;
+    int64_t y;
+    int64_t z;
 
-    for (const auto [index, vertex] : vertices | ranges::views::enumerate)
+    bool operator==(const WeldKey& other) const = default;
+};
+
+static int64_t makeWeldKeyCoordinate(const float coordinate, const float inverse_tolerance)
+{
+    if (inverse_tolerance > 0.0f)
     {
-        auto iterator = unique_vertices_indices.find(vertex);
-        if (iterator == unique_vertices_indices.end())
+        // Very far or infinite positions would overflow the grid coordinate, so they are clamped to the edge of the grid. Invalid positions get a key
+        // outside of the grid, so that they are never welded to valid ones.
+        constexpr double max_grid_coordinate = 0x1p62;
+        const double grid_coordinate = static_cast<double>(coordinate) * inverse_tolerance;
+        if (std::isnan(grid_coordinate)) [[unlikely]]
         {
-            // This is the very first time we see this position, register it
-            unique_vertices_indices[vertex] = index;
-            new_vertices_indices[index] = index;
-        }
-        else
-        {
-            new_vertices_indices[index] = iterator->second;
+            return std::numeric_limits<int64_t>::min();
         }
+        return std::llround(std::clamp(grid_coordinate, -max_grid_coordinate, max_grid_coordinate));
     }
 
-    for (const Face& face : faces)
+    // -0 and +0 are the same position, so give them the same bits
+    return std::bit_cast<uint32_t>(coordinate == 0.0f ? 0.0f : coordinate);
+}
+
+static WeldKey makeWeldKey(const Point3F& vertex, const float inverse_tolerance)
+{
+    return WeldKey{ .x = makeWeldKeyCoordinate(vertex.x(), inverse_tolerance),
+                    .y = makeWeldKeyCoordinate(vertex.y(), inverse_tolerance),
+                    .z = makeWeldKeyCoordinate(vertex.z(), inverse_tolerance) };
+}
+
+static uint64_t hashWeldKey(const WeldKey& key)
+{
+    // Multiplicative mixing of each coordinate, followed by a final avalanche so that the top bits can be used for partitioning
+    uint64_t hash = static_cast<uint64_t>(key.x) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (hash >> 29) ^ static_cast<uint64_t>(key.y)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 32) ^ static_cast<uint64_t>(key.z)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+const std::vector<Face>& groupSimilarVertices(
+    const std::span<const Face>& faces,
+    const std::span<const Point3F>& vertices,
+    const float weld_tolerance,
+    ThreadPool& thread_pool,
+    UnwrapScratch& scratch)
+{
+    const size_t vertices_count = vertices.size();
+    const float inverse_tolerance = weld_tolerance > 0.0f ? 1.0f / weld_tolerance : 0.0f;
+    constexpr size_t grain_size = 16384;
+
+    std::vector<uint64_t>& vertices_hashes = scratch.vertices_hashes;
+    vertices_hashes.resize(vertices_count);
+    thread_pool.parallelFor(
+        vertices_count,
+        grain_size,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t index = begin; index < end; ++index)
+            {
+                vertices_hashes[index] = hashWeldKey(makeWeldKey(vertices[index], inverse_tolerance));
+            }
+        });
+
+    // Use a few buckets per thread, selected by the top bits of the hash
+    const size_t buckets_count = vertices_count > grain_size ? std::bit_ceil(thread_pool.threadCount() * 4) : 1;
+    const int bucket_shift = 64 - std::countr_zero(buckets_count);
+    const auto get_bucket = [&bucket_shift, &vertices_hashes](const size_t index) -> size_t
     {
-        faces_with_similar_indices.push_back(Face{ new_vertices_indices[face.i1], new_vertices_indices[face.i2], new_vertices_indices[face.i3] });
+        return bucket_shift < 64 ? vertices_hashes[index] >> bucket_shift : 0;
+    };
+
+    // Counting sort of the vertices indices by bucket, which keeps the vertices ordered by index inside a bucket
+    const size_t blocks_count = (vertices_count + grain_size - 1) / grain_size;
+    std::vector<uint32_t>& blocks_histograms = scratch.blocks_histograms;
+    blocks_histograms.assign(blocks_count * buckets_count, 0);
+    thread_pool.parallelFor(
+        blocks_count,
+        1,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t block = begin; block < end; ++block)
+            {
+                uint32_t* histogram = &blocks_histograms[block * buckets_count];
+                for (size_t index = block * grain_size; index < std::min((block + 1) * grain_size, vertices_count); ++index)
+                {
+                    ++histogram[get_bucket(index)];
+                }
+            }
+        });
+
+    std::vector<uint32_t> buckets_offsets(buckets_count + 1, 0);
+    uint32_t offset = 0;
+    for (size_t bucket = 0; bucket < buckets_count; ++bucket)
+    {
+        buckets_offsets[bucket] = offset;
+        for (size_t block = 0; block < blocks_count; ++block)
+        {
+            uint32_t& count = blocks_histograms[block * buckets_count + bucket];
+            const uint32_t block_count = count;
+            count = offset; // The histogram now contains the insertion offset of the block
+            offset += block_count;
+        }
     }
+    buckets_offsets[buckets_count] = offset;
+
+    std::vector<uint32_t>& sorted_vertices = scratch.sorted_vertices;
+    sorted_vertices.resize(vertices_count);
+    thread_pool.parallelFor(
+        blocks_count,
+        1,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t block = begin; block < end; ++block)
+            {
+                uint32_t* insert_offsets = &blocks_histograms[block * buckets_count];
+                for (size_t index = block * grain_size; index < std::min((block + 1) * grain_size, vertices_count); ++index)
+                {
+                    sorted_vertices[insert_offsets[get_bucket(index)]++] = static_cast<uint32_t>(index);
+                }
+            }
+        });
+
+    // Now weld each bucket independently
+    std::vector<uint32_t>& new_vertices_indices = scratch.new_vertices_indices;
+    new_vertices_indices.resize(vertices_count);
+    thread_pool.parallelFor(
+        buckets_count,
+        1,
+        [&](const size_t begin, const size_t end)
+        {
+            constexpr uint32_t empty_slot = std::numeric_limits<uint32_t>::max();
+            std::vector<uint32_t> slots;
+
+            for (size_t bucket = begin; bucket < end; ++bucket)
+            {
+                const uint32_t bucket_begin = buckets_offsets[bucket];
+                const uint32_t bucket_end = buckets_offsets[bucket + 1];
+
+                // Keep the load factor under 0.5 so that linear probing sequences stay short
+                const size_t slots_count = std::bit_ceil(std::max<size_t>((bucket_end - bucket_begin) * 2, 16));
+                const size_t slots_mask = slots_count - 1;
+                slots.assign(slots_count, empty_slot);
+
+                for (uint32_t sorted_index = bucket_begin; sorted_index < bucket_end; ++sorted_index)
+                {
+                    const uint32_t index = sorted_vertices[sorted_index];
+                    const uint64_t hash = vertices_hashes[index];
+                    const WeldKey key = makeWeldKey(vertices[index], inverse_tolerance);
+
+                    for (size_t slot = hash & slots_mask;; slot = (slot + 1) & slots_mask)
+                    {
+                        const uint32_t slot_vertex = slots[slot];
+                        if (slot_vertex == empty_slot)
+                        {
+                            // This is the very first time we see this position, register it
+                            slots[slot] = index;
+                            new_vertices_indices[index] = index;
+                            break;
+                        }
+
+                        if (vertices_hashes[slot_vertex] == hash && makeWeldKey(vertices[slot_vertex], inverse_tolerance) == key)
+                        {
+                            new_vertices_indices[index] = slot_vertex;
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+
+    std::vector<Face>& faces_with_similar_indices = scratch.faces_with_similar_indices;
+    faces_with_similar_indices.resize(faces.size());
+    thread_pool.parallelFor(
+        faces.size(),
+        grain_size,
+        [&](const size_t begin, const size_t end)
+        {
+            for (size_t index = begin; index < end; ++index)
+            {
+                const Face& face = faces[index];
+                faces_with_similar_indices[index] = Face{ new_vertices_indices[face.i1], new_vertices_indices[face.i2], new_vertices_indices[face.i3] };
+            }
+        });
 
     return faces_with_similar_indices;
 }
 
-/*!
- * Packs the charts (faces groups) onto a texture image by using as much space as possible without having them overlap
- * @param vertices The list of vertices position
- * @param faces The list of vertices position
- * @param charts The list of grouped faces indices
- * @param uv_coords The original UV coordinates, which may be overlapping and not fitting on an image. As an output they
- *                  will be properly scaled and distributed on the image.
- * @param texture_width Output width to be used for the texture image
- * @param texture_height Output height to be used for the texture image
- * @return
- */
 bool packCharts(
-    const std::vector<Point3F>& vertices,
-    const std::vector<Face>& faces,
-    const std::vector<std::vector<size_t>>& charts,
-    std::vector<Point2F>& uv_coords,
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const Charts& charts,
+    const std::span<Point2F>& uv_coords,
     uint32_t& texture_width,
-    uint32_t& texture_height)
+    uint32_t& texture_height,
+    const bool skyline_packing,
+    xatlas::Atlas* atlas,
+    UnwrapStats& stats)
 {
-    // Create an xatlas object and register the mesh with the basic UV coordinates
-    xatlas::Atlas* atlas = xatlas::Create();
+    spdlog::stopwatch timer;
+
+    // Register the mesh with the basic UV coordinates
     xatlas::UvMeshDecl mesh;
     mesh.vertexUvData = uv_coords.data();
     mesh.indexData = faces.data();
@@ -384,24 +754,33 @@ bool packCharts(
     mesh.vertexStride = sizeof(Point2F);
     mesh.indexCount = faces.size() * 3;
     mesh.indexFormat = xatlas::IndexFormat::UInt32;
+    // The faces and UV coordinates outlive the packing, and are already laid out as xatlas stores them, so don't copy them
+    mesh.borrowData = true;
 
     if (xatlas::AddUvMesh(atlas, mesh) != xatlas::AddMeshError::Success)
     {
-        xatlas::Destroy(atlas);
+        xatlas::ClearMeshes(atlas);
         spdlog::error("Error adding mesh");
         return false;
     }
-
     // Use a smaller calculation definition, which makes the calculation much faster and adds more margin between the islands, then scale it up
     constexpr uint32_t calculation_definition = 512;
     constexpr uint32_t desired_definition = 4096;
 
     // Set the pre-calculated faces groups
-    xatlas::SetCharts(atlas, charts);
+    stats.dropped_faces_count = xatlas::SetCharts(atlas, charts.faces.data(), charts.offsets.data(), charts.size());
+    stats.set_charts_duration = lapDuration(timer);
 
     // Now pack the charts on the image
-    constexpr xatlas::PackOptions pack_options{ .padding = 0, .resolution = calculation_definition };
+    const xatlas::PackOptions pack_options{ .padding = 0,
+                                            .resolution = calculation_definition,
+                                            .strategy = skyline_packing ? xatlas::PackStrategy::Skyline : xatlas::PackStrategy::Bitmap };
     xatlas::PackCharts(atlas, pack_options);
+    stats.atlas_utilization = 0.0f;
+    for (uint32_t atlas_index = 0; atlas_index < atlas->atlasCount; ++atlas_index)
+    {
+        stats.atlas_utilization += atlas->utilization[atlas_index] / static_cast<float>(atlas->atlasCount);
+    }
 
     // Now scale up the size
     texture_width = atlas->width;
@@ -421,19 +800,130 @@ bool packCharts(
         uv_coords[vertex.xref] = Point2F{ .x = vertex.uv[0] / width, .y = vertex.uv[1] / height };
     }
 
-    xatlas::Destroy(atlas);
+    xatlas::ClearMeshes(atlas);
+    stats.pack_charts_duration = lapDuration(timer);
     return true;
 }
 
-bool smartUnwrap(const std::vector<Point3F>& vertices, const std::vector<Face>& faces, std::vector<Point2F>& uv_coords, uint32_t& texture_width, uint32_t& texture_height)
+struct UnwrapContext::Impl
 {
+    explicit Impl(std::unique_ptr<ThreadPool> owned_pool, ThreadPool& pool)
+        : owned_thread_pool(std::move(owned_pool))
+        , thread_pool(pool)
+        , atlas(xatlas::Create(&thread_pool))
+    {
+        // The meshes are cleared after each unwrapping, so the memory of the atlas is reused by the next one instead of being allocated again
+        xatlas::SetAllocator(atlas, xatlas::Allocator::Arena);
+    }
+
+    Impl(const Impl&) = delete;
+
+    Impl& operator=(const Impl&) = delete;
+
+    ~Impl()
+    {
+        xatlas::Destroy(atlas);
+    }
+
+    std::unique_ptr<ThreadPool> owned_thread_pool;
+    ThreadPool& thread_pool;
+    xatlas::Atlas* atlas;
+    UnwrapScratch scratch;
+};
+
+UnwrapContext::UnwrapContext(const size_t threads_count)
+{
+    auto thread_pool = std::make_unique<ThreadPool>(threads_count);
+    ThreadPool& thread_pool_reference = *thread_pool;
+    impl_ = std::make_unique<Impl>(std::move(thread_pool), thread_pool_reference);
+}
+
+UnwrapContext::UnwrapContext(ThreadPool& thread_pool)
+    : impl_(std::make_unique<Impl>(nullptr, thread_pool))
+{
+}
+
+UnwrapContext::~UnwrapContext() = default;
+
+ThreadPool& UnwrapContext::threadPool()
+{
+    return impl_->thread_pool;
+}
+
+bool UnwrapContext::smartUnwrap(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const std::span<Point2F>& uv_coords,
+    uint32_t& texture_width,
+    uint32_t& texture_height,
+    const UnwrapOptions& options,
+    UnwrapStats* stats)
+{
+    UnwrapStats local_stats;
+    UnwrapStats& current_stats = stats ? *stats : local_stats;
+    current_stats = UnwrapStats();
+
+    if (uv_coords.size() != vertices.size()) [[unlikely]]
+    {
+        spdlog::error("UV coordinates should be sized as the vertices, got {} for {} vertices", uv_coords.size(), vertices.size());
+        return false;
+    }
+
+    ThreadPool& thread_pool = impl_->thread_pool;
+    UnwrapScratch& scratch = impl_->scratch;
+
+    spdlog::stopwatch total_timer;
+    spdlog::stopwatch timer;
+
     // Make a first projection and grouping of the faces to UV coordinates
-    std::vector<std::vector<size_t>> charts = makeCharts(vertices, faces, uv_coords);
+    Charts charts = makeCharts(vertices, faces, uv_coords, options.projection_normals_max_samples, thread_pool, scratch);
+    current_stats.charts_count_before_split = charts.size();
+    current_stats.make_charts_duration = lapDuration(timer);
 
     // Split faces group to get only groups of adjacent faces
-    std::vector<Face> const faces_with_similar_indices = groupSimilarVertices(faces, vertices);
-    charts = splitNonLinkedFacesCharts(charts, faces_with_similar_indices);
+    const std::vector<Face>& faces_with_similar_indices = groupSimilarVertices(faces, vertices, options.vertices_weld_tolerance, thread_pool, scratch);
+    current_stats.weld_duration = lapDuration(timer);
+    charts = splitNonLinkedFacesCharts(charts, faces_with_similar_indices, thread_pool);
+    current_stats.charts_count_after_split = charts.size();
+    current_stats.split_charts_duration = lapDuration(timer);
+    current_stats.scratch_memory = scratch.memoryUsage();
 
     // Now pack the UV coordinates onto a proper image surface
-    return packCharts(vertices, faces, charts, uv_coords, texture_width, texture_height);
+    const bool packed = packCharts(vertices, faces, charts, uv_coords, texture_width, texture_height, options.skyline_packing, impl_->atlas, current_stats);
+    current_stats.total_duration = lapDuration(total_timer);
+    return packed;
+}
+
+static UnwrapContext& defaultContext()
+{
+    static UnwrapContext default_context;
+    return default_context;
+}
+
+ThreadPool& defaultThreadPool()
+{
+    return defaultContext().threadPool();
+}
+
+bool smartUnwrap(
+    const std::span<const Point3F>& vertices,
+    const std::span<const Face>& faces,
+    const std::span<Point2F>& uv_coords,
+    uint32_t& texture_width,
+    uint32_t& texture_height,
+    const UnwrapOptions& options,
+    UnwrapStats* stats)
+{
+    UnwrapContext& default_context = defaultContext();
+    static std::mutex default_context_mutex;
+
+    std::unique_lock lock(default_context_mutex, std::try_to_lock);
+    if (lock.owns_lock()) [[likely]]
+    {
+        return default_context.smartUnwrap(vertices, faces, uv_coords, texture_width, texture_height, options, stats);
+    }
+
+    // The default context is already used by another thread, so rather than waiting use a temporary one, which can still share the threads
+    UnwrapContext context(default_context.threadPool());
+    return context.smartUnwrap(vertices, faces, uv_coords, texture_width, texture_height, options, stats);
 }
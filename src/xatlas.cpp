@@ -42,6 +42,7 @@ Copyright (c) 2012 Brandon Pelfrey
 #endif
 #include <assert.h>
 #include <atomic>
+#include <bit>
 #include <condition_variable>
 #include <float.h> // FLT_MAX
 #include <limits.h>
@@ -53,6 +54,8 @@ Copyright (c) 2012 Brandon Pelfrey
 #include <stdio.h>
 #include <string.h>
 
+#include "ThreadPool.h"
+
 #ifndef XA_DEBUG
 #ifdef NDEBUG
 #define XA_DEBUG 0
@@ -65,6 +68,15 @@ Copyright (c) 2012 Brandon Pelfrey
 #define XA_MULTITHREADED 1
 #endif
 
+// Instructions sets of the bit image kernels. AVX2 is selected at runtime, NEON is always available where it is enabled.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define XA_AVX2_DISPATCH 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define XA_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define XA_STR(x) #x
 #define XA_XSTR(x) XA_STR(x)
 
@@ -145,10 +157,262 @@ static FreeFunc s_free = free;
 static PrintFunc s_print = printf;
 static bool s_printVerbose = false;
 
+// Monotonic allocator, which takes the allocations from the end of big blocks and only releases them all at once with reset(). Each thread allocates
+// from its own chain of blocks, so that no lock is taken unless a block is added, and the last allocation of a thread is grown or released in place,
+// which is the common case of arrays being filled. Each allocation is preceded by its size, so that it can be reallocated. Pointers which weren't
+// allocated from the arena, e.g. before it was used, go to the heap functions.
+class Arena
+{
+public:
+    Arena()
+        : m_id(nextId())
+    {
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena()
+    {
+        Chain* chain = m_chains;
+        while (chain)
+        {
+            Chain* next = chain->next;
+            for (uint32_t i = 0; i < chain->blockCount; i++)
+                freeMemory(chain->blocks[i].data);
+            chain->~Chain();
+            freeMemory(chain);
+            chain = next;
+        }
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        Chain& chain = threadChain();
+        const size_t allocationSize = kHeaderSize + alignSize(size);
+        if (ptr)
+        {
+            if (chain.owns(ptr))
+            {
+                const Block& block = chain.blocks[chain.blockCount - 1];
+                if (ptr == chain.last && (uint8_t*)ptr - kHeaderSize + allocationSize <= block.data + block.size)
+                {
+                    chain.used = (size_t)((uint8_t*)ptr - block.data) - kHeaderSize + allocationSize;
+                    *sizeOf(ptr) = size;
+                    return ptr;
+                }
+            }
+            else if (! ownedByAnyChain(ptr))
+                return s_realloc(ptr, size);
+        }
+        void* mem = allocate(chain, size, allocationSize);
+        if (ptr)
+            memcpy(mem, ptr, *sizeOf(ptr) < size ? *sizeOf(ptr) : size);
+        return mem;
+    }
+
+    void free(void* ptr)
+    {
+        Chain& chain = threadChain();
+        if (chain.owns(ptr))
+        {
+            // Only the last allocation of the thread can be released, the others are released by reset()
+            if (ptr == chain.last)
+            {
+                chain.used = (size_t)((uint8_t*)ptr - chain.blocks[chain.blockCount - 1].data) - kHeaderSize;
+                chain.last = nullptr;
+            }
+            return;
+        }
+        if (! ownedByAnyChain(ptr))
+            freeMemory(ptr);
+    }
+
+    // Releases all the allocations, which shouldn't be used by any thread anymore. The blocks of each thread are merged into a single one, which is
+    // kept so that the next allocations of the thread don't need any.
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (Chain* chain = m_chains; chain; chain = chain->next)
+        {
+            if (chain->blockCount > 1)
+            {
+                size_t size = 0;
+                for (uint32_t i = 0; i < chain->blockCount; i++)
+                {
+                    size += chain->blocks[i].size;
+                    freeMemory(chain->blocks[i].data);
+                }
+                chain->blocks[0] = allocateBlock(size);
+                chain->blockCount = 1;
+            }
+            chain->used = 0;
+            chain->last = nullptr;
+        }
+    }
+
+private:
+    static const size_t kHeaderSize = 16; // Keeps the allocations aligned to 16 bytes
+    static const size_t kMinBlockSize = 1 << 18;
+    static const uint32_t kMaxBlocks = 48; // The blocks double in size, this is never reached
+
+    struct Block
+    {
+        uint8_t* data;
+        size_t size;
+    };
+
+    // Blocks of a thread. Only this thread allocates from them, but it adds blocks under the mutex of the arena, so that the other threads can
+    // check whether they own a pointer.
+    struct Chain
+    {
+        bool owns(const void* ptr) const
+        {
+            for (uint32_t i = 0; i < blockCount; i++)
+            {
+                if (ptr >= blocks[i].data && ptr < blocks[i].data + blocks[i].size)
+                    return true;
+            }
+            return false;
+        }
+
+        Block blocks[kMaxBlocks];
+        uint32_t blockCount = 0;
+        size_t used = 0; // In the last block
+        void* last = nullptr; // Last allocation, if it hasn't been released
+        std::thread::id thread;
+        Chain* next = nullptr;
+    };
+
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> s_lastId{ 0 };
+        return ++s_lastId;
+    }
+
+    static size_t alignSize(size_t size)
+    {
+        return (size + kHeaderSize - 1) & ~(kHeaderSize - 1);
+    }
+
+    static size_t* sizeOf(void* ptr)
+    {
+        return (size_t*)((uint8_t*)ptr - kHeaderSize);
+    }
+
+    static Block allocateBlock(size_t size)
+    {
+        Block block;
+        block.data = (uint8_t*)s_realloc(nullptr, size);
+        block.size = size;
+        return block;
+    }
+
+    static void freeMemory(void* ptr)
+    {
+        if (s_free)
+            s_free(ptr);
+        else
+            s_realloc(ptr, 0);
+    }
+
+    // The chain of the current thread is looked up once, then cached by the thread until it uses another arena. The ids of the arenas are never
+    // reused, so a destroyed arena can't be mistaken for a new one.
+    Chain& threadChain()
+    {
+        struct ThreadCache
+        {
+            uint64_t arenaId = 0;
+            Chain* chain = nullptr;
+        };
+        static thread_local ThreadCache s_cache;
+        if (s_cache.arenaId == m_id)
+            return *s_cache.chain;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::thread::id thread = std::this_thread::get_id();
+        Chain* chain = m_chains;
+        while (chain && chain->thread != thread)
+            chain = chain->next;
+        if (! chain)
+        {
+            chain = new (s_realloc(nullptr, sizeof(Chain))) Chain();
+            chain->thread = thread;
+            chain->next = m_chains;
+            m_chains = chain;
+        }
+        s_cache.arenaId = m_id;
+        s_cache.chain = chain;
+        return *chain;
+    }
+
+    // For the pointers allocated by another thread
+    bool ownedByAnyChain(const void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Chain* chain = m_chains; chain; chain = chain->next)
+        {
+            if (chain->owns(ptr))
+                return true;
+        }
+        return false;
+    }
+
+    void* allocate(Chain& chain, size_t size, size_t allocationSize)
+    {
+        if (chain.blockCount == 0 || chain.used + allocationSize > chain.blocks[chain.blockCount - 1].size)
+        {
+            XA_DEBUG_ASSERT(chain.blockCount < kMaxBlocks);
+            const size_t blockSize = chain.blockCount == 0 ? kMinBlockSize : chain.blocks[chain.blockCount - 1].size * 2;
+            const Block block = allocateBlock(blockSize > allocationSize ? blockSize : allocationSize);
+            std::lock_guard<std::mutex> lock(m_mutex);
+            chain.blocks[chain.blockCount++] = block;
+            chain.used = 0;
+        }
+        uint8_t* mem = chain.blocks[chain.blockCount - 1].data + chain.used + kHeaderSize;
+        chain.used += allocationSize;
+        *sizeOf(mem) = size;
+        chain.last = mem;
+        return mem;
+    }
+
+    const uint64_t m_id;
+    Chain* m_chains = nullptr; // Added under the mutex
+    std::mutex m_mutex;
+};
+
+// Arena of the atlas being worked on by the thread, which all the allocations are taken from, if the atlas has one. The tasks run with the arena of
+// the thread which started them.
+static thread_local Arena* s_arena = nullptr;
+
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena* arena)
+        : m_previous(s_arena)
+    {
+        s_arena = arena;
+    }
+
+    ~ArenaScope()
+    {
+        s_arena = m_previous;
+    }
+
+private:
+    Arena* m_previous;
+};
+
 static void* Realloc(void* ptr, size_t size, const char* /*file*/, int /*line*/)
 {
     if (size == 0 && ! ptr)
         return nullptr;
+    if (s_arena)
+    {
+        if (size > 0)
+            return s_arena->realloc(ptr, size);
+        s_arena->free(ptr);
+        return nullptr;
+    }
     if (size == 0 && s_free)
     {
         s_free(ptr);
@@ -928,14 +1192,116 @@ private:
     Array<uint32_t> m_wordArray;
 };
 
+// Tests whether the bits of an image row, shifted by offsetX, overlap the bits of another image row, for the words [firstWord, lastWord] of the image.
+// Words which are out of the other row are ignored.
+typedef bool (*RowsOverlapFunc)(const uint64_t* row, uint32_t rowStride, const uint64_t* imageRow, uint32_t firstWord, uint32_t lastWord, uint32_t offsetX);
+
+static XA_INLINE bool rowsOverlap(const uint64_t* row, uint32_t rowStride, const uint64_t* imageRow, uint32_t firstWord, uint32_t lastWord, uint32_t offsetX)
+{
+    const uint32_t shift = offsetX & 63;
+    const uint32_t wordOffset = offsetX >> 6;
+    for (uint32_t i = firstWord; i <= lastWord; i++)
+    {
+        const uint32_t index = i + wordOffset;
+        if (index >= rowStride)
+            break;
+        const uint64_t block = imageRow[i];
+        if ((row[index] & (block << shift)) != 0)
+            return true;
+        if (shift != 0 && index + 1 < rowStride && (row[index + 1] & (block >> (64 - shift))) != 0)
+            return true;
+    }
+    return false;
+}
+
+#if XA_AVX2_DISPATCH
+__attribute__((target("avx2"))) static bool
+    rowsOverlapAvx2(const uint64_t* row, uint32_t rowStride, const uint64_t* imageRow, uint32_t firstWord, uint32_t lastWord, uint32_t offsetX)
+{
+    // Shifting by 64 gives 0, so the aligned case doesn't need a special case.
+    const __m128i shiftLeft = _mm_cvtsi32_si128((int)(offsetX & 63));
+    const __m128i shiftRight = _mm_cvtsi32_si128((int)(64 - (offsetX & 63)));
+    const uint32_t wordOffset = offsetX >> 6;
+    uint32_t i = firstWord;
+    for (; i + 3 <= lastWord && i + wordOffset + 4 < rowStride; i += 4)
+    {
+        const __m256i block = _mm256_loadu_si256((const __m256i*)(imageRow + i));
+        const __m256i words = _mm256_loadu_si256((const __m256i*)(row + i + wordOffset));
+        const __m256i nextWords = _mm256_loadu_si256((const __m256i*)(row + i + wordOffset + 1));
+        const __m256i overlap = _mm256_or_si256(_mm256_and_si256(words, _mm256_sll_epi64(block, shiftLeft)), _mm256_and_si256(nextWords, _mm256_srl_epi64(block, shiftRight)));
+        if (! _mm256_testz_si256(overlap, overlap))
+            return true;
+    }
+    return rowsOverlap(row, rowStride, imageRow, i, lastWord, offsetX);
+}
+#endif
+
+#if XA_NEON
+static bool rowsOverlapNeon(const uint64_t* row, uint32_t rowStride, const uint64_t* imageRow, uint32_t firstWord, uint32_t lastWord, uint32_t offsetX)
+{
+    // Negative shifts are right shifts, and shifting by 64 gives 0, so the aligned case doesn't need a special case.
+    const int64x2_t shiftLeft = vdupq_n_s64((int64_t)(offsetX & 63));
+    const int64x2_t shiftRight = vdupq_n_s64((int64_t)(offsetX & 63) - 64);
+    const uint32_t wordOffset = offsetX >> 6;
+    uint32_t i = firstWord;
+    for (; i + 1 <= lastWord && i + wordOffset + 2 < rowStride; i += 2)
+    {
+        const uint64x2_t block = vld1q_u64(imageRow + i);
+        const uint64x2_t words = vld1q_u64(row + i + wordOffset);
+        const uint64x2_t nextWords = vld1q_u64(row + i + wordOffset + 1);
+        const uint64x2_t overlap = vorrq_u64(vandq_u64(words, vshlq_u64(block, shiftLeft)), vandq_u64(nextWords, vshlq_u64(block, shiftRight)));
+        if ((vgetq_lane_u64(overlap, 0) | vgetq_lane_u64(overlap, 1)) != 0)
+            return true;
+    }
+    return rowsOverlap(row, rowStride, imageRow, i, lastWord, offsetX);
+}
+#endif
+
+// Vector kernel for the rows which are at least kRowsOverlapVectorWords wide, the narrower ones are tested inline.
+static RowsOverlapFunc selectRowsOverlap()
+{
+#if XA_AVX2_DISPATCH
+    if (__builtin_cpu_supports("avx2"))
+        return rowsOverlapAvx2;
+#elif XA_NEON
+    return rowsOverlapNeon;
+#endif
+    return nullptr;
+}
+
+// Transposes a 64x64 bit matrix whose rows are words, so that bit x of word y becomes bit y of word x, by swapping ever smaller blocks: first the
+// 32x32 blocks off the diagonal, then the 16x16 blocks off the diagonal of each 32x32 block, and so on.
+static void transposeBits64(uint64_t* block)
+{
+    uint64_t mask = UINT64_C(0x00000000FFFFFFFF);
+    for (uint32_t width = 32; width != 0; width >>= 1, mask ^= mask << width)
+    {
+        for (uint32_t k = 0; k < 64; k = ((k | width) + 1) & ~width)
+        {
+            const uint64_t t = ((block[k] >> width) ^ block[k | width]) & mask;
+            block[k] ^= t << width;
+            block[k | width] ^= t;
+        }
+    }
+}
+
+// The rows are followed by the occupied x range of each row, and then by the one of each band of kBandHeight rows, so that most blits can be
+// accepted without looking at the bits. A range is stored in a word as its begin in the low bits and its end in the high bits. It is empty if its
+// end is 0, so that zeroed memory is an empty image.
 class BitImage
 {
 public:
+    static const uint32_t kBandHeight = 64;
+    static const uint32_t kRowsOverlapVectorWords = 4;
+    static const uint32_t kOccupancyBlockSize = 8; // The occupancy pyramid has blocks of 8x8 and 64x64 texels.
+
     BitImage()
         : m_width(0)
         , m_height(0)
         , m_rowStride(0)
         , m_data()
+        , m_words(nullptr)
+        , m_hasOccupancy(false)
     {
     }
 
@@ -943,10 +1309,12 @@ public:
         : m_width(w)
         , m_height(h)
         , m_data()
+        , m_hasOccupancy(false)
     {
         m_rowStride = (m_width + 63) >> 6;
-        m_data.resize(m_rowStride * m_height);
+        m_data.resize(wordCount(w, h));
         m_data.zeroOutMemory();
+        m_words = m_data.data();
     }
 
     BitImage(const BitImage& other) = delete;
@@ -960,216 +1328,613 @@ public:
         return m_height;
     }
 
+    static uint32_t wordCount(uint32_t w, uint32_t h)
+    {
+        return ((w + 63) >> 6) * h + h + (h + kBandHeight - 1) / kBandHeight;
+    }
+
+    // Makes the image a view onto memory it doesn't own, e.g. a slice of an arena shared by many images, which should hold wordCount(w, h) words.
+    // The memory isn't cleared, and the image can't be resized afterwards.
+    void setStorage(uint32_t w, uint32_t h, uint64_t* words)
+    {
+        m_data.destroy();
+        m_width = w;
+        m_height = h;
+        m_rowStride = (w + 63) >> 6;
+        m_words = words;
+    }
+
     void copyTo(BitImage& other)
     {
+        XA_DEBUG_ASSERT(other.m_words == other.m_data.data());
         other.m_width = m_width;
         other.m_height = m_height;
         other.m_rowStride = m_rowStride;
-        m_data.copyTo(other.m_data);
+        other.m_data.resize(wordCount(m_width, m_height));
+        memcpy(other.m_data.data(), m_words, wordCount(m_width, m_height) * sizeof(uint64_t));
+        other.m_words = other.m_data.data();
     }
 
     void resize(uint32_t w, uint32_t h, bool discard)
     {
+        XA_DEBUG_ASSERT(m_words == m_data.data());
         const uint32_t rowStride = (w + 63) >> 6;
         if (discard)
         {
-            m_data.resize(rowStride * h);
+            m_data.resize(wordCount(w, h));
             m_data.zeroOutMemory();
+            m_words = m_data.data();
         }
         else
         {
             Array<uint64_t> tmp;
-            tmp.resize(rowStride * h);
+            tmp.resize(wordCount(w, h));
             memset(tmp.data(), 0, tmp.size() * sizeof(uint64_t));
             // If only height has changed, can copy all rows at once.
             if (rowStride == m_rowStride)
             {
-                memcpy(tmp.data(), m_data.data(), m_rowStride * min(m_height, h) * sizeof(uint64_t));
+                memcpy(tmp.data(), m_words, m_rowStride * min(m_height, h) * sizeof(uint64_t));
             }
             else if (m_width > 0 && m_height > 0)
             {
                 const uint32_t height = min(m_height, h);
                 for (uint32_t i = 0; i < height; i++)
-                    memcpy(&tmp[i * rowStride], &m_data[i * m_rowStride], min(rowStride, m_rowStride) * sizeof(uint64_t));
+                    memcpy(&tmp[i * rowStride], &m_words[i * m_rowStride], min(rowStride, m_rowStride) * sizeof(uint64_t));
             }
             tmp.moveTo(m_data);
+            m_words = m_data.data();
         }
         m_width = w;
         m_height = h;
         m_rowStride = rowStride;
+        if (! discard)
+            updateRanges();
+        if (m_hasOccupancy)
+            enableOccupancy();
     }
 
     bool get(uint32_t x, uint32_t y) const
     {
         XA_DEBUG_ASSERT(x < m_width && y < m_height);
         const uint32_t index = (x >> 6) + y * m_rowStride;
-        return (m_data[index] & (UINT64_C(1) << (uint64_t(x) & UINT64_C(63)))) != 0;
+        return (m_words[index] & (UINT64_C(1) << (uint64_t(x) & UINT64_C(63)))) != 0;
     }
 
     void set(uint32_t x, uint32_t y)
     {
         XA_DEBUG_ASSERT(x < m_width && y < m_height);
         const uint32_t index = (x >> 6) + y * m_rowStride;
-        m_data[index] |= UINT64_C(1) << (uint64_t(x) & UINT64_C(63));
+        m_words[index] |= UINT64_C(1) << (uint64_t(x) & UINT64_C(63));
+        uint64_t* ranges = rowRanges();
+        ranges[y] = extendRange(ranges[y], x, x + 1);
+        ranges[m_height + y / kBandHeight] = extendRange(ranges[m_height + y / kBandHeight], x, x + 1);
         XA_DEBUG_ASSERT(get(x, y));
     }
 
-    void zeroOutMemory()
+    // Sets the texels [x0, x1) of a row.
+    void setSpan(uint32_t x0, uint32_t x1, uint32_t y)
     {
-        m_data.zeroOutMemory();
+        XA_DEBUG_ASSERT(x0 < x1 && x1 <= m_width && y < m_height);
+        uint64_t* row = m_words + y * m_rowStride;
+        const uint32_t firstWord = x0 >> 6, lastWord = (x1 - 1) >> 6;
+        const uint64_t firstMask = UINT64_MAX << (x0 & 63), lastMask = UINT64_MAX >> (63 - ((x1 - 1) & 63));
+        if (firstWord == lastWord)
+        {
+            row[firstWord] |= firstMask & lastMask;
+        }
+        else
+        {
+            row[firstWord] |= firstMask;
+            for (uint32_t i = firstWord + 1; i < lastWord; i++)
+                row[i] = UINT64_MAX;
+            row[lastWord] |= lastMask;
+        }
+        uint64_t* ranges = rowRanges();
+        ranges[y] = extendRange(ranges[y], x0, x1);
+        ranges[m_height + y / kBandHeight] = extendRange(ranges[m_height + y / kBandHeight], x0, x1);
     }
 
-    bool canBlit(const BitImage& image, uint32_t offsetX, uint32_t offsetY) const
+    void zeroOutMemory()
     {
-        for (uint32_t y = 0; y < image.m_height; y++)
-        {
-            const uint32_t thisY = y + offsetY;
-            if (thisY >= m_height)
-                continue;
-            uint32_t x = 0;
-            for (;;)
-            {
-                const uint32_t thisX = x + offsetX;
-                if (thisX >= m_width)
-                    break;
-                const uint32_t thisBlockShift = thisX % 64;
-                const uint64_t thisBlock = m_data[(thisX >> 6) + thisY * m_rowStride] >> thisBlockShift;
-                const uint32_t blockShift = x % 64;
-                const uint64_t block = image.m_data[(x >> 6) + y * image.m_rowStride] >> blockShift;
-                if ((thisBlock & block) != 0)
-                    return false;
-                x += 64 - max(thisBlockShift, blockShift);
-                if (x >= image.m_width)
-                    break;
-            }
-        }
-        return true;
+        memset(m_words, 0, wordCount(m_width, m_height) * sizeof(uint64_t));
     }
 
-    void dilate(uint32_t padding)
+    // Starts maintaining the occupancy pyramid, which tells which blocks of the image are completely full or empty. Only resize() and
+    // updateOccupancy() keep it up to date, set() doesn't.
+    void enableOccupancy()
     {
-        BitImage tmp(m_width, m_height);
-        for (uint32_t p = 0; p < padding; p++)
+        m_hasOccupancy = true;
+        uint32_t w = m_width, h = m_height;
+        for (uint32_t i = 0; i < 2; i++)
         {
-            tmp.zeroOutMemory();
-            for (uint32_t y = 0; y < m_height; y++)
-            {
-                for (uint32_t x = 0; x < m_width; x++)
-                {
-                    bool b = get(x, y);
-                    if (! b)
-                    {
-                        if (x > 0)
-                        {
-                            b |= get(x - 1, y);
-                            if (y > 0)
-                                b |= get(x - 1, y - 1);
-                            if (y < m_height - 1)
-                                b |= get(x - 1, y + 1);
-                        }
-                        if (y > 0)
-                            b |= get(x, y - 1);
-                        if (y < m_height - 1)
-                            b |= get(x, y + 1);
-                        if (x < m_width - 1)
-                        {
-                            b |= get(x + 1, y);
-                            if (y > 0)
-                                b |= get(x + 1, y - 1);
-                            if (y < m_height - 1)
-                                b |= get(x + 1, y + 1);
-                        }
-                    }
-                    if (b)
-                        tmp.set(x, y);
-                }
-            }
-            tmp.m_data.copyTo(m_data);
+            OccupancyLevel& level = m_occupancy[i];
+            level.width = w = (w + kOccupancyBlockSize - 1) / kOccupancyBlockSize;
+            level.height = h = (h + kOccupancyBlockSize - 1) / kOccupancyBlockSize;
+            level.rowStride = (w + 63) >> 6;
+            level.full.resize(level.rowStride * h);
+            level.full.zeroOutMemory();
+            level.used.resize(level.rowStride * h);
+            level.used.zeroOutMemory();
         }
+        updateOccupancy(0, 0, m_width, m_height);
     }
 
-private:
-    uint32_t m_width;
-    uint32_t m_height;
-    uint32_t m_rowStride; // In uint64_t's
-    Array<uint64_t> m_data;
-};
-
-static uint32_t sdbmHash(const void* data_in, uint32_t size, uint32_t h = 5381)
-{
-    const uint8_t* data = (const uint8_t*)data_in;
-    uint32_t i = 0;
-    while (i < size)
+    // Updates the occupancy pyramid after texels of the given rectangle have been set.
+    void updateOccupancy(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
     {
-        h = (h << 16) + (h << 6) - h + (uint32_t)data[i++];
+        XA_DEBUG_ASSERT(m_hasOccupancy);
+        const uint32_t x1 = min(x + w, m_width), y1 = min(y + h, m_height);
+        if (x >= x1 || y >= y1)
+            return;
+        const OccupancyLevel& level = m_occupancy[0];
+        updateOccupancyLevel(m_words, m_words, m_rowStride, m_height, m_occupancy[0], x / 8, y / 8, (x1 - 1) / 8, (y1 - 1) / 8);
+        updateOccupancyLevel(level.full.data(), level.used.data(), level.rowStride, level.height, m_occupancy[1], x / 64, y / 64, (x1 - 1) / 64, (y1 - 1) / 64);
     }
-    return h;
-}
 
-template<typename T>
-static uint32_t hash(const T& t, uint32_t h = 5381)
-{
-    return sdbmHash(&t, sizeof(T), h);
-}
+    // Whether the image is only one word wide and at most one band high, which canBlit() tests in a few instructions.
+    bool isSingleWord() const
+    {
+        return m_rowStride == 1 && m_height <= kBandHeight;
+    }
 
-template<typename Key>
-struct Hash
-{
-    uint32_t operator()(const Key& k) const
+    // Picks up to count texels which are set, spread over the rows of the image: the first and last texels of some rows.
+    uint32_t sampleSetTexels(Vector2i* texels, uint32_t count) const
     {
-        return hash(k);
+        const uint64_t* ranges = rowRanges();
+        uint32_t sampleCount = 0;
+        for (uint32_t i = 0; i < count && m_height > 0; i++)
+        {
+            const uint32_t y = count > 1 ? (uint32_t)((uint64_t)i * (m_height - 1) / (count - 1)) : 0;
+            if (rangeEnd(ranges[y]) != 0)
+                texels[sampleCount++] = Vector2i((int)((i & 1) ? rangeEnd(ranges[y]) - 1 : rangeBegin(ranges[y])), (int)y);
+        }
+        return sampleCount;
     }
-};
 
-template<typename Key>
-struct PassthroughHash
-{
-    uint32_t operator()(const Key& k) const
+    // Tests whether any of the texels, offset by offsetX and offsetY, is in a full block of this image, in which case an image with these texels
+    // set can't be blitted there. Requires the occupancy pyramid.
+    bool hitsFullBlock(const Vector2i* texels, uint32_t count, uint32_t offsetX, uint32_t offsetY) const
     {
-        return (uint32_t)k;
+        XA_DEBUG_ASSERT(m_hasOccupancy);
+        const OccupancyLevel& level = m_occupancy[0];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const uint32_t x = (uint32_t)texels[i].x + offsetX, y = (uint32_t)texels[i].y + offsetY;
+            if (x >= m_width || y >= m_height)
+                continue;
+            const uint32_t blockX = x / 8, blockY = y / 8;
+            if ((level.full[(blockX >> 6) + blockY * level.rowStride] >> (blockX & 63)) & 1)
+                return true;
+        }
+        return false;
     }
-};
 
-template<typename Key>
-struct Equal
-{
-    bool operator()(const Key& k0, const Key& k1) const
+    bool canBlit(const BitImage& image, uint32_t offsetX, uint32_t offsetY) const
     {
-        return k0 == k1;
+        if (offsetY >= m_height)
+            return true;
+        // Most charts are small, and tested against a dense atlas where the summaries don't help.
+        if (image.isSingleWord())
+            return canBlitWord(image, offsetX, offsetY);
+        return canBlitRows(image, offsetX, offsetY);
     }
-};
 
-template<typename Key, typename H = Hash<Key>, typename E = Equal<Key>>
-class HashMap
-{
-public:
-    HashMap(uint32_t size)
-        : m_size(size)
-        , m_numSlots(0)
-        , m_slots(nullptr)
-        , m_keys()
-        , m_next()
+    // Dilates the image by padding texels towards its 8 neighbours, a row at a time. rows is scratch memory.
+    void dilate(uint32_t padding, Array<uint64_t>& rows)
     {
+        if (m_width == 0 || m_height == 0 || padding == 0)
+            return;
+        rows.resize(m_rowStride * 3);
+        for (uint32_t p = 0; p < padding; p++)
+            dilateRows(m_words, m_words, false, rows.data());
+        updateRanges();
     }
 
-    ~HashMap()
+    // Makes neighbours the texels which are not set in this image but have a set texel among their 8 neighbours, i.e. the ones that a dilation by
+    // one texel would add. rows is scratch memory.
+    void findNeighbours(BitImage& neighbours, Array<uint64_t>& rows) const
     {
-        if (m_slots)
-            XA_FREE(m_slots);
+        neighbours.resize(m_width, m_height, true);
+        if (m_width == 0 || m_height == 0)
+            return;
+        rows.resize(m_rowStride * 3);
+        dilateRows(m_words, neighbours.m_words, true, rows.data());
+        neighbours.updateRanges();
     }
 
-    void destroy()
+    // Writes the image with x and y swapped to dest, which must be height x width, a block of 64x64 texels at a time.
+    void transposeTo(BitImage& dest) const
     {
-        if (m_slots)
+        XA_DEBUG_ASSERT(dest.m_width == m_height && dest.m_height == m_width);
+        uint64_t block[64];
+        for (uint32_t blockY = 0; blockY < dest.m_rowStride; blockY++)
         {
-            XA_FREE(m_slots);
-            m_slots = nullptr;
+            const uint32_t rowCount = min(64u, m_height - blockY * 64);
+            for (uint32_t blockX = 0; blockX < m_rowStride; blockX++)
+            {
+                uint64_t used = 0;
+                for (uint32_t y = 0; y < 64; y++)
+                {
+                    block[y] = y < rowCount ? m_words[(blockY * 64 + y) * m_rowStride + blockX] : 0;
+                    used |= block[y];
+                }
+                if (used != 0)
+                    transposeBits64(block);
+                const uint32_t columnCount = min(64u, m_width - blockX * 64);
+                for (uint32_t x = 0; x < columnCount; x++)
+                    dest.m_words[(blockX * 64 + x) * dest.m_rowStride + blockY] = block[x];
+            }
         }
-        m_keys.destroy();
-        m_next.destroy();
+        dest.updateRanges();
     }
 
-    uint32_t add(const Key& key)
+    // Copies the bits of an image of the same size.
+    void copyBits(const BitImage& other)
+    {
+        XA_DEBUG_ASSERT(other.m_width == m_width && other.m_height == m_height);
+        memcpy(m_words, other.m_words, wordCount(m_width, m_height) * sizeof(uint64_t));
+    }
+
+    const uint64_t* row(uint32_t y) const
+    {
+        XA_DEBUG_ASSERT(y < m_height);
+        return m_words + y * m_rowStride;
+    }
+
+    uint32_t rowStride() const
+    {
+        return m_rowStride;
+    }
+
+private:
+    static uint32_t rangeBegin(uint64_t range)
+    {
+        return (uint32_t)range;
+    }
+
+    static uint32_t rangeEnd(uint64_t range)
+    {
+        return (uint32_t)(range >> 32);
+    }
+
+    static uint64_t extendRange(uint64_t range, uint32_t begin, uint32_t end)
+    {
+        if (rangeEnd(range) != 0)
+        {
+            begin = min(begin, rangeBegin(range));
+            end = max(end, rangeEnd(range));
+        }
+        return uint64_t(begin) | (uint64_t(end) << 32);
+    }
+
+    static bool rangesOverlap(uint64_t range, uint32_t begin, uint32_t end)
+    {
+        return begin < rangeEnd(range) && rangeBegin(range) < end;
+    }
+
+    static RowsOverlapFunc rowsOverlapFunc()
+    {
+        static const RowsOverlapFunc func = selectRowsOverlap();
+        return func;
+    }
+
+    uint64_t* rowRanges() const
+    {
+        return m_words + m_rowStride * m_height;
+    }
+
+    // Tests an image which is only one word wide and at most one band high.
+    XA_INLINE bool canBlitWord(const BitImage& image, uint32_t offsetX, uint32_t offsetY) const
+    {
+        const uint32_t wordOffset = offsetX >> 6;
+        if (wordOffset >= m_rowStride)
+            return true;
+        const uint32_t shift = offsetX & 63;
+        const bool hasNextWord = shift != 0 && wordOffset + 1 < m_rowStride;
+        const uint32_t height = min(image.m_height, m_height - offsetY);
+        const uint64_t* row = m_words + offsetY * m_rowStride + wordOffset;
+        for (uint32_t y = 0; y < height; y++, row += m_rowStride)
+        {
+            const uint64_t block = image.m_words[y];
+            uint64_t overlap = row[0] & (block << shift);
+            if (hasNextWord)
+                overlap |= row[1] & (block >> (64 - shift));
+            if (overlap != 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool canBlitRows(const BitImage& image, uint32_t offsetX, uint32_t offsetY) const
+    {
+        if (m_hasOccupancy && isEmpty(offsetX, offsetY, image.m_width, image.m_height))
+            return true;
+        const uint64_t* ranges = rowRanges();
+        const uint64_t* imageRanges = image.rowRanges();
+        const uint32_t height = min(image.m_height, m_height - offsetY);
+        // Bounds of the whole image in this image, to skip the bands of this image which don't have anything where the image is. Images which are
+        // not taller than a band are better off testing their rows directly.
+        uint32_t imageBegin = 0, imageEnd = UINT32_MAX;
+        if (image.m_height > kBandHeight)
+        {
+            imageBegin = UINT32_MAX;
+            imageEnd = 0;
+            for (uint32_t band = 0; band < (image.m_height + kBandHeight - 1) / kBandHeight; band++)
+            {
+                const uint64_t range = imageRanges[image.m_height + band];
+                if (rangeEnd(range) != 0)
+                {
+                    imageBegin = min(imageBegin, rangeBegin(range) + offsetX);
+                    imageEnd = max(imageEnd, rangeEnd(range) + offsetX);
+                }
+            }
+        }
+        uint32_t y = 0;
+        while (y < height)
+        {
+            const uint32_t thisY = y + offsetY;
+            const uint32_t bandEnd = min(height, (thisY / kBandHeight + 1) * kBandHeight - offsetY);
+            if (! rangesOverlap(ranges[m_height + thisY / kBandHeight], imageBegin, imageEnd))
+            {
+                y = bandEnd;
+                continue;
+            }
+            for (; y < bandEnd; y++)
+            {
+                const uint64_t imageRange = imageRanges[y];
+                if (rangeEnd(imageRange) == 0)
+                    continue;
+                const uint64_t* row = m_words + (y + offsetY) * m_rowStride;
+                const uint64_t* imageRow = image.m_words + y * image.m_rowStride;
+                uint32_t firstWord = rangeBegin(imageRange) >> 6;
+                uint32_t lastWord = (rangeEnd(imageRange) - 1) >> 6;
+                if (lastWord - firstWord + 1 >= kRowsOverlapVectorWords)
+                {
+                    // Only the words where both rows have something need to be tested. Narrow rows are faster to test directly.
+                    const uint64_t range = ranges[y + offsetY];
+                    const uint32_t begin = max(rangeBegin(imageRange) + offsetX, rangeBegin(range));
+                    const uint32_t end = min(rangeEnd(imageRange) + offsetX, rangeEnd(range));
+                    if (begin >= end)
+                        continue;
+                    firstWord = (begin - offsetX) >> 6;
+                    lastWord = (end - 1 - offsetX) >> 6;
+                    if (lastWord - firstWord + 1 >= kRowsOverlapVectorWords && rowsOverlapFunc())
+                    {
+                        if (rowsOverlapFunc()(row, m_rowStride, imageRow, firstWord, lastWord, offsetX))
+                            return false;
+                        continue;
+                    }
+                }
+                if (rowsOverlap(row, m_rowStride, imageRow, firstWord, lastWord, offsetX))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Tests whether no texel of the rectangle is set, at the resolution of the occupancy blocks, so a rectangle next to set texels isn't empty.
+    bool isEmpty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const
+    {
+        const uint32_t x1 = min(x + w, m_width), y1 = min(y + h, m_height);
+        if (x >= x1 || y >= y1)
+            return true;
+        // The coarse level is enough when the rectangle is in an empty part of the image.
+        if (! anyBitSet(m_occupancy[1].used.data(), m_occupancy[1].rowStride, x / 64, y / 64, (x1 - 1) / 64, (y1 - 1) / 64))
+            return true;
+        return ! anyBitSet(m_occupancy[0].used.data(), m_occupancy[0].rowStride, x / 8, y / 8, (x1 - 1) / 8, (y1 - 1) / 8);
+    }
+
+    // Tests whether any bit of the inclusive rectangle of a bitmap is set.
+    static bool anyBitSet(const uint64_t* bits, uint32_t rowStride, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+    {
+        const uint32_t firstWord = x0 >> 6, lastWord = x1 >> 6;
+        const uint64_t firstMask = UINT64_MAX << (x0 & 63), lastMask = UINT64_MAX >> (63 - (x1 & 63));
+        for (uint32_t y = y0; y <= y1; y++)
+        {
+            const uint64_t* row = bits + y * rowStride;
+            if (firstWord == lastWord)
+            {
+                if (row[firstWord] & firstMask & lastMask)
+                    return true;
+                continue;
+            }
+            if ((row[firstWord] & firstMask) || (row[lastWord] & lastMask))
+                return true;
+            for (uint32_t i = firstWord + 1; i < lastWord; i++)
+            {
+                if (row[i])
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // Level of the occupancy pyramid, whose bitmaps have one bit per block, laid out like the rows of an image.
+    struct OccupancyLevel
+    {
+        uint32_t width = 0, height = 0, rowStride = 0;
+        Array<uint64_t> full; // All the texels of the block are set
+        Array<uint64_t> used; // Any texel of the block is set
+    };
+
+    // Updates the blocks of a level in the inclusive block rectangle, from the full and used bitmaps of the level below, which are both the bits of
+    // the image for the first level. Each block is 8x8 bits of the level below, so a byte of 8 of its rows.
+    static void updateOccupancyLevel(const uint64_t* full, const uint64_t* used, uint32_t rowStride, uint32_t height, OccupancyLevel& level, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+    {
+        for (uint32_t blockY = y0; blockY <= y1; blockY++)
+        {
+            for (uint32_t blockX = x0; blockX <= x1; blockX++)
+            {
+                const uint32_t wordIndex = blockX >> 3, shift = (blockX & 7) * 8;
+                uint64_t allFull = blockY * 8 + 8 <= height ? 0xFF : 0;
+                uint64_t anyUsed = 0;
+                for (uint32_t y = blockY * 8; y < min(blockY * 8 + 8, height); y++)
+                {
+                    allFull &= full[y * rowStride + wordIndex] >> shift;
+                    anyUsed |= used[y * rowStride + wordIndex] >> shift;
+                }
+                const uint32_t index = (blockX >> 6) + blockY * level.rowStride;
+                const uint64_t bit = UINT64_C(1) << (blockX & 63);
+                level.full[index] = (allFull & 0xFF) == 0xFF ? level.full[index] | bit : level.full[index] & ~bit;
+                level.used[index] = (anyUsed & 0xFF) != 0 ? level.used[index] | bit : level.used[index] & ~bit;
+            }
+        }
+    }
+
+    // Writes the rows of source dilated by one texel to dest, which can be source. Each row is the OR of the rows above, at and below it, which are
+    // first dilated horizontally, so the rows are computed before the one above them is overwritten. If onlyAdded, the texels of source are left out,
+    // which requires dest to be another image. rows is scratch memory for 3 rows. The ranges of dest aren't updated.
+    void dilateRows(const uint64_t* source, uint64_t* dest, bool onlyAdded, uint64_t* rows) const
+    {
+        XA_DEBUG_ASSERT(! onlyAdded || source != dest);
+        uint64_t* above = rows;
+        uint64_t* current = rows + m_rowStride;
+        uint64_t* below = rows + m_rowStride * 2;
+        memset(above, 0, m_rowStride * sizeof(uint64_t));
+        dilateRowHorizontally(source, current);
+        for (uint32_t y = 0; y < m_height; y++)
+        {
+            const uint64_t* sourceRow = source + y * m_rowStride;
+            if (y + 1 < m_height)
+                dilateRowHorizontally(sourceRow + m_rowStride, below);
+            else
+                memset(below, 0, m_rowStride * sizeof(uint64_t));
+            uint64_t* destRow = dest + y * m_rowStride;
+            for (uint32_t i = 0; i < m_rowStride; i++)
+            {
+                const uint64_t word = above[i] | current[i] | below[i];
+                destRow[i] = onlyAdded ? word & ~sourceRow[i] : word;
+            }
+            uint64_t* tmp = above;
+            above = current;
+            current = below;
+            below = tmp;
+        }
+    }
+
+    // Sets the bits of dest which are set in the row or next to a set bit of the row, without going past the width of the image.
+    void dilateRowHorizontally(const uint64_t* row, uint64_t* dest) const
+    {
+        for (uint32_t i = 0; i < m_rowStride; i++)
+        {
+            uint64_t word = row[i] | (row[i] << 1) | (row[i] >> 1);
+            if (i > 0)
+                word |= row[i - 1] >> 63;
+            if (i + 1 < m_rowStride)
+                word |= row[i + 1] << 63;
+            dest[i] = word;
+        }
+        if (m_width & 63)
+            dest[m_rowStride - 1] &= (UINT64_C(1) << (m_width & 63)) - 1;
+    }
+
+    // Calculates the occupied ranges from the bits.
+    void updateRanges()
+    {
+        uint64_t* ranges = rowRanges();
+        memset(ranges, 0, (wordCount(m_width, m_height) - m_rowStride * m_height) * sizeof(uint64_t));
+        for (uint32_t y = 0; y < m_height; y++)
+        {
+            const uint64_t* row = m_words + y * m_rowStride;
+            uint32_t first = 0;
+            while (first < m_rowStride && row[first] == 0)
+                first++;
+            if (first == m_rowStride)
+                continue;
+            uint32_t last = m_rowStride - 1;
+            while (row[last] == 0)
+                last--;
+            const uint32_t begin = first * 64 + (uint32_t)std::countr_zero(row[first]);
+            const uint32_t end = last * 64 + 64 - (uint32_t)std::countl_zero(row[last]);
+            ranges[y] = extendRange(0, begin, end);
+            ranges[m_height + y / kBandHeight] = extendRange(ranges[m_height + y / kBandHeight], begin, end);
+        }
+    }
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_rowStride; // In uint64_t's
+    Array<uint64_t> m_data; // Unused when the image is a view onto memory it doesn't own
+    uint64_t* m_words; // Either m_data or the external memory
+    bool m_hasOccupancy;
+    OccupancyLevel m_occupancy[2]; // Blocks of 8x8 texels, then of 8x8 of these blocks
+};
+
+static uint32_t sdbmHash(const void* data_in, uint32_t size, uint32_t h = 5381)
+{
+    const uint8_t* data = (const uint8_t*)data_in;
+    uint32_t i = 0;
+    while (i < size)
+    {
+        h = (h << 16) + (h << 6) - h + (uint32_t)data[i++];
+    }
+    return h;
+}
+
+template<typename T>
+static uint32_t hash(const T& t, uint32_t h = 5381)
+{
+    return sdbmHash(&t, sizeof(T), h);
+}
+
+template<typename Key>
+struct Hash
+{
+    uint32_t operator()(const Key& k) const
+    {
+        return hash(k);
+    }
+};
+
+template<typename Key>
+struct PassthroughHash
+{
+    uint32_t operator()(const Key& k) const
+    {
+        return (uint32_t)k;
+    }
+};
+
+template<typename Key>
+struct Equal
+{
+    bool operator()(const Key& k0, const Key& k1) const
+    {
+        return k0 == k1;
+    }
+};
+
+template<typename Key, typename H = Hash<Key>, typename E = Equal<Key>>
+class HashMap
+{
+public:
+    HashMap(uint32_t size)
+        : m_size(size)
+        , m_numSlots(0)
+        , m_slots(nullptr)
+        , m_keys()
+        , m_next()
+    {
+    }
+
+    ~HashMap()
+    {
+        if (m_slots)
+            XA_FREE(m_slots);
+    }
+
+    void destroy()
+    {
+        if (m_slots)
+        {
+            XA_FREE(m_slots);
+            m_slots = nullptr;
+        }
+        m_keys.destroy();
+        m_next.destroy();
+    }
+
+    uint32_t add(const Key& key)
     {
         if (! m_slots)
             alloc();
@@ -1675,59 +2440,48 @@ struct Task
 };
 
 #if XA_MULTITHREADED
+// Runs the tasks on a ThreadPool, which may be shared with other users.
 class TaskScheduler
 {
 public:
-    TaskScheduler()
-        : m_shutdown(false)
+    explicit TaskScheduler(ThreadPool* threadPool)
+        : m_threadPool(threadPool)
     {
-        m_threadIndex = 0;
+        if (! m_threadPool)
+        {
+            m_ownedThreadPool = XA_NEW(ThreadPool);
+            m_threadPool = m_ownedThreadPool;
+        }
         // Max with current task scheduler usage is 1 per thread + 1 deep nesting, but allow for some slop.
-        m_maxGroups = std::thread::hardware_concurrency() * 4;
+        m_maxGroups = threadCount() * 4;
         m_groups = XA_ALLOC_ARRAY(TaskGroup, m_maxGroups);
         for (uint32_t i = 0; i < m_maxGroups; i++)
         {
             new (&m_groups[i]) TaskGroup();
             m_groups[i].free = true;
-            m_groups[i].ref = 0;
             m_groups[i].userData = nullptr;
         }
-        m_workers.resize(std::thread::hardware_concurrency() <= 1 ? 1 : std::thread::hardware_concurrency() - 1);
-        for (uint32_t i = 0; i < m_workers.size(); i++)
-        {
-            new (&m_workers[i]) Worker();
-            m_workers[i].wakeup = false;
-            m_workers[i].thread = XA_NEW_ARGS(std::thread, workerThread, this, &m_workers[i], i + 1);
-        }
     }
 
     ~TaskScheduler()
     {
-        m_shutdown = true;
-        for (uint32_t i = 0; i < m_workers.size(); i++)
-        {
-            Worker& worker = m_workers[i];
-            XA_DEBUG_ASSERT(worker.thread);
-            worker.wakeup = true;
-            worker.cv.notify_one();
-            if (worker.thread->joinable())
-                worker.thread->join();
-            worker.thread->~thread();
-            XA_FREE(worker.thread);
-            worker.~Worker();
-        }
         for (uint32_t i = 0; i < m_maxGroups; i++)
             m_groups[i].~TaskGroup();
         XA_FREE(m_groups);
+        if (m_ownedThreadPool)
+        {
+            m_ownedThreadPool->~ThreadPool();
+            XA_FREE(m_ownedThreadPool);
+        }
     }
 
     uint32_t threadCount() const
     {
-        return max(1u, std::thread::hardware_concurrency()); // Including the main thread.
+        return (uint32_t)m_threadPool->threadCount(); // Including the main thread.
     }
 
     // userData is passed to Task::func as groupUserData.
-    TaskGroupHandle createTaskGroup(void* userData = nullptr, uint32_t reserveSize = 0)
+    TaskGroupHandle createTaskGroup(void* userData = nullptr, uint32_t /*reserveSize*/ = 0)
     {
         // Claim the first free group.
         for (uint32_t i = 0; i < m_maxGroups; i++)
@@ -1736,13 +2490,7 @@ public:
             bool expected = true;
             if (! group.free.compare_exchange_strong(expected, false))
                 continue;
-            group.queueLock.lock();
-            group.queueHead = 0;
-            group.queue.clear();
-            group.queue.reserve(reserveSize);
-            group.queueLock.unlock();
             group.userData = userData;
-            group.ref = 0;
             TaskGroupHandle handle;
             handle.value = i;
             return handle;
@@ -1757,16 +2505,15 @@ public:
     {
         XA_DEBUG_ASSERT(handle.value != UINT32_MAX);
         TaskGroup& group = m_groups[handle.value];
-        group.queueLock.lock();
-        group.queue.push_back(task);
-        group.queueLock.unlock();
-        group.ref++;
-        // Wake up a worker to run this task.
-        for (uint32_t i = 0; i < m_workers.size(); i++)
-        {
-            m_workers[i].wakeup = true;
-            m_workers[i].cv.notify_one();
-        }
+        void* groupUserData = group.userData;
+        Arena* arena = s_arena;
+        m_threadPool->run(
+            group.tasks,
+            [task, groupUserData, arena]()
+            {
+                ArenaScope arenaScope(arena);
+                task.func(groupUserData, task.userData);
+            });
     }
 
     void wait(TaskGroupHandle* handle)
@@ -1776,105 +2523,39 @@ public:
             XA_DEBUG_ASSERT(false);
             return;
         }
-        // Run tasks from the group queue until empty.
+        // The waiting thread runs the queued tasks of the group, and sleeps while the other ones are running.
         TaskGroup& group = m_groups[handle->value];
-        for (;;)
-        {
-            Task* task = nullptr;
-            group.queueLock.lock();
-            if (group.queueHead < group.queue.size())
-                task = &group.queue[group.queueHead++];
-            group.queueLock.unlock();
-            if (! task)
-                break;
-            task->func(group.userData, task->userData);
-            group.ref--;
-        }
-        // Even though the task queue is empty, workers can still be running tasks.
-        while (group.ref > 0)
-            std::this_thread::yield();
+        m_threadPool->wait(group.tasks);
         group.free = true;
         handle->value = UINT32_MAX;
     }
 
-    static uint32_t currentThreadIndex()
+    uint32_t currentThreadIndex() const
     {
-        return m_threadIndex;
+        return (uint32_t)m_threadPool->currentThreadIndex();
     }
 
 private:
     struct TaskGroup
     {
         std::atomic<bool> free;
-        Array<Task> queue; // Items are never removed. queueHead is incremented to pop items.
-        uint32_t queueHead = 0;
-        Spinlock queueLock;
-        std::atomic<uint32_t> ref; // Increment when a task is enqueued, decrement when a task finishes.
+        ThreadPool::TaskGroup tasks;
         void* userData;
     };
 
-    struct Worker
-    {
-        std::thread* thread = nullptr;
-        std::mutex mutex;
-        std::condition_variable cv;
-        std::atomic<bool> wakeup;
-    };
-
+    ThreadPool* m_threadPool;
+    ThreadPool* m_ownedThreadPool = nullptr;
     TaskGroup* m_groups;
-    Array<Worker> m_workers;
-    std::atomic<bool> m_shutdown;
     uint32_t m_maxGroups;
-    static thread_local uint32_t m_threadIndex;
-
-    static void workerThread(TaskScheduler* scheduler, Worker* worker, uint32_t threadIndex)
-    {
-        m_threadIndex = threadIndex;
-        std::unique_lock<std::mutex> lock(worker->mutex);
-        for (;;)
-        {
-            worker->cv.wait(
-                lock,
-                [=]
-                {
-                    return worker->wakeup.load();
-                });
-            worker->wakeup = false;
-            for (;;)
-            {
-                if (scheduler->m_shutdown)
-                    return;
-                // Look for a task in any of the groups and run it.
-                TaskGroup* group = nullptr;
-                Task* task = nullptr;
-                for (uint32_t i = 0; i < scheduler->m_maxGroups; i++)
-                {
-                    group = &scheduler->m_groups[i];
-                    if (group->free || group->ref == 0)
-                        continue;
-                    group->queueLock.lock();
-                    if (group->queueHead < group->queue.size())
-                    {
-                        task = &group->queue[group->queueHead++];
-                        group->queueLock.unlock();
-                        break;
-                    }
-                    group->queueLock.unlock();
-                }
-                if (! task)
-                    break;
-                task->func(group->userData, task->userData);
-                group->ref--;
-            }
-        }
-    }
 };
-
-thread_local uint32_t TaskScheduler::m_threadIndex;
 #else
 class TaskScheduler
 {
 public:
+    explicit TaskScheduler(ThreadPool* /*threadPool*/)
+    {
+    }
+
     ~TaskScheduler()
     {
         for (uint32_t i = 0; i < m_groups.size(); i++)
@@ -1917,7 +2598,7 @@ public:
         handle->value = UINT32_MAX;
     }
 
-    static uint32_t currentThreadIndex()
+    uint32_t currentThreadIndex() const
     {
         return 0;
     }
@@ -1948,36 +2629,30 @@ template<typename T>
 class ThreadLocal
 {
 public:
-    ThreadLocal()
+    explicit ThreadLocal(const TaskScheduler* taskScheduler)
+        : m_taskScheduler(taskScheduler)
+        , m_count(taskScheduler->threadCount())
     {
-#if XA_MULTITHREADED
-        const uint32_t n = std::thread::hardware_concurrency();
-#else
-        const uint32_t n = 1;
-#endif
-        m_array = XA_ALLOC_ARRAY(T, n);
-        for (uint32_t i = 0; i < n; i++)
+        m_array = XA_ALLOC_ARRAY(T, m_count);
+        for (uint32_t i = 0; i < m_count; i++)
             new (&m_array[i]) T;
     }
 
     ~ThreadLocal()
     {
-#if XA_MULTITHREADED
-        const uint32_t n = std::thread::hardware_concurrency();
-#else
-        const uint32_t n = 1;
-#endif
-        for (uint32_t i = 0; i < n; i++)
+        for (uint32_t i = 0; i < m_count; i++)
             m_array[i].~T();
         XA_FREE(m_array);
     }
 
     T& get() const
     {
-        return m_array[TaskScheduler::currentThreadIndex()];
+        return m_array[m_taskScheduler->currentThreadIndex()];
     }
 
 private:
+    const TaskScheduler* m_taskScheduler;
+    uint32_t m_count;
     T* m_array;
 };
 
@@ -2307,10 +2982,14 @@ struct UvMesh
 {
     UvMeshDecl decl;
     BitArray faceIgnore;
-    Array<uint32_t> faceMaterials;
-    Array<uint32_t> indices;
-    Array<Vector2>
-        texcoords; // Copied from input and never modified, UvMeshInstance::texcoords are. Used to restore UvMeshInstance::texcoords so packing can be run multiple times.
+    ConstArrayView<uint32_t> faceMaterials;
+    ConstArrayView<uint32_t> indices;
+    ConstArrayView<Vector2>
+        texcoords; // Never modified, UvMeshInstance::texcoords are. Used to restore UvMeshInstance::texcoords so packing can be run multiple times.
+    // The copies of the input which the views above point to, empty when it is borrowed from the caller.
+    Array<uint32_t> faceMaterialsCopy;
+    Array<uint32_t> indicesCopy;
+    Array<Vector2> texcoordsCopy;
     Array<UvMeshChart*> charts;
     Array<uint32_t> vertexToChartMap;
 };
@@ -2429,9 +3108,6 @@ private:
     float m_area;
 };
 
-/// A callback to sample the environment. Return false to terminate rasterization.
-typedef bool (*SamplingCallback)(void* param, int x, int y);
-
 /// A triangle for rasterization.
 struct Triangle
 {
@@ -2458,99 +3134,55 @@ struct Triangle
         return area != 0.0f;
     }
 
-    // extents has to be multiple of BK_SIZE!!
-    bool drawAA(const Vector2& extents, SamplingCallback cb, void* param)
+    // Sets the texels of the image that the triangle overlaps. In each row, the half-edge functions give the span of the texels which are inside
+    // the triangle, which is set a word at a time, and the few texels around it, which may be partially covered, are tested one by one.
+    void draw(BitImage* image) const
     {
         const float PX_INSIDE = 1.0f / sqrtf(2.0f);
         const float PX_OUTSIDE = -1.0f / sqrtf(2.0f);
-        const float BK_SIZE = 8;
-        const float BK_INSIDE = sqrtf(BK_SIZE * BK_SIZE / 2.0f);
-        const float BK_OUTSIDE = -sqrtf(BK_SIZE * BK_SIZE / 2.0f);
         // Bounding rectangle
-        float minx = floorf(max(min3(v1.x, v2.x, v3.x), 0.0f));
-        float miny = floorf(max(min3(v1.y, v2.y, v3.y), 0.0f));
-        float maxx = ceilf(min(max3(v1.x, v2.x, v3.x), extents.x - 1.0f));
-        float maxy = ceilf(min(max3(v1.y, v2.y, v3.y), extents.y - 1.0f));
-        // There's no reason to align the blocks to the viewport, instead we align them to the origin of the triangle bounds.
-        minx = floorf(minx);
-        miny = floorf(miny);
-        // minx = (float)(((int)minx) & (~((int)BK_SIZE - 1))); // align to blocksize (we don't need to worry about blocks partially out of viewport)
-        // miny = (float)(((int)miny) & (~((int)BK_SIZE - 1)));
-        minx += 0.5;
-        miny += 0.5; // sampling at texel centers!
-        maxx += 0.5;
-        maxy += 0.5;
+        const int minX = (int)floorf(max(min3(v1.x, v2.x, v3.x), 0.0f));
+        const int minY = (int)floorf(max(min3(v1.y, v2.y, v3.y), 0.0f));
+        const int maxX = (int)ceilf(min(max3(v1.x, v2.x, v3.x), (float)image->width() - 1.0f));
+        const int maxY = (int)ceilf(min(max3(v1.y, v2.y, v3.y), (float)image->height() - 1.0f));
         // Half-edge constants
-        float C1 = n1.x * (-v1.x) + n1.y * (-v1.y);
-        float C2 = n2.x * (-v2.x) + n2.y * (-v2.y);
-        float C3 = n3.x * (-v3.x) + n3.y * (-v3.y);
-        // Loop through blocks
-        for (float y0 = miny; y0 <= maxy; y0 += BK_SIZE)
-        {
-            for (float x0 = minx; x0 <= maxx; x0 += BK_SIZE)
-            {
-                // Corners of block
-                float xc = (x0 + (BK_SIZE - 1) / 2.0f);
-                float yc = (y0 + (BK_SIZE - 1) / 2.0f);
-                // Evaluate half-space functions
-                float aC = C1 + n1.x * xc + n1.y * yc;
-                float bC = C2 + n2.x * xc + n2.y * yc;
-                float cC = C3 + n3.x * xc + n3.y * yc;
-                // Skip block when outside an edge
-                if ((aC <= BK_OUTSIDE) || (bC <= BK_OUTSIDE) || (cC <= BK_OUTSIDE))
-                    continue;
-                // Accept whole block when totally covered
-                if ((aC >= BK_INSIDE) && (bC >= BK_INSIDE) && (cC >= BK_INSIDE))
+        const Vector2 normals[3] = { n1, n2, n3 };
+        const float constants[3] = { n1.x * (-v1.x) + n1.y * (-v1.y), n2.x * (-v2.x) + n2.y * (-v2.y), n3.x * (-v3.x) + n3.y * (-v3.y) };
+        for (int y = minY; y <= maxY; y++)
+        {
+            // Ranges of the x of the texel centers where the texels are inside all the edges, and where they are not outside any edge.
+            const float centerY = (float)y + 0.5f;
+            float insideBegin = (float)minX + 0.5f, insideEnd = (float)maxX + 0.5f;
+            float overlapBegin = insideBegin, overlapEnd = insideEnd;
+            for (uint32_t i = 0; i < 3; i++)
+            {
+                const float c = constants[i] + normals[i].y * centerY;
+                clipSpan(normals[i].x, c, PX_INSIDE, insideBegin, insideEnd);
+                clipSpan(normals[i].x, c, PX_OUTSIDE, overlapBegin, overlapEnd);
+            }
+            if (! (overlapBegin <= overlapEnd))
+                continue;
+            // The ranges are widened and narrowed by a texel, so that float rounding doesn't change which texels are set.
+            const int first = max(minX, (int)ceilf(overlapBegin - 0.5f) - 1);
+            const int last = min(maxX, (int)floorf(overlapEnd - 0.5f) + 1);
+            int insideFirst = last + 1, insideLast = last;
+            if (insideBegin <= insideEnd)
+            {
+                insideFirst = max(first, (int)ceilf(insideBegin - 0.5f) + 1);
+                insideLast = min(last, (int)floorf(insideEnd - 0.5f) - 1);
+                if (insideFirst > insideLast)
                 {
-                    for (float y = y0; y < y0 + BK_SIZE; y++)
-                    {
-                        for (float x = x0; x < x0 + BK_SIZE; x++)
-                        {
-                            if (! cb(param, (int)x, (int)y))
-                                return false;
-                        }
-                    }
-                }
-                else
-                { // Partially covered block
-                    float CY1 = C1 + n1.x * x0 + n1.y * y0;
-                    float CY2 = C2 + n2.x * x0 + n2.y * y0;
-                    float CY3 = C3 + n3.x * x0 + n3.y * y0;
-                    for (float y = y0; y < y0 + BK_SIZE; y++)
-                    { // @@ This is not clipping to scissor rectangle correctly.
-                        float CX1 = CY1;
-                        float CX2 = CY2;
-                        float CX3 = CY3;
-                        for (float x = x0; x < x0 + BK_SIZE; x++)
-                        { // @@ This is not clipping to scissor rectangle correctly.
-                            if (CX1 >= PX_INSIDE && CX2 >= PX_INSIDE && CX3 >= PX_INSIDE)
-                            {
-                                if (! cb(param, (int)x, (int)y))
-                                    return false;
-                            }
-                            else if ((CX1 >= PX_OUTSIDE) && (CX2 >= PX_OUTSIDE) && (CX3 >= PX_OUTSIDE))
-                            {
-                                // triangle partially covers pixel. do clipping.
-                                ClippedTriangle ct(v1 - Vector2(x, y), v2 - Vector2(x, y), v3 - Vector2(x, y));
-                                ct.clipAABox(-0.5, -0.5, 0.5, 0.5);
-                                if (ct.area() > 0.0f)
-                                {
-                                    if (! cb(param, (int)x, (int)y))
-                                        return false;
-                                }
-                            }
-                            CX1 += n1.x;
-                            CX2 += n2.x;
-                            CX3 += n3.x;
-                        }
-                        CY1 += n1.y;
-                        CY2 += n2.y;
-                        CY3 += n3.y;
-                    }
+                    insideFirst = last + 1;
+                    insideLast = last;
                 }
             }
+            for (int x = first; x < insideFirst; x++)
+                drawTexel(image, x, y, constants, PX_INSIDE, PX_OUTSIDE);
+            if (insideFirst <= insideLast)
+                image->setSpan((uint32_t)insideFirst, (uint32_t)insideLast + 1, (uint32_t)y);
+            for (int x = insideLast + 1; x <= last; x++)
+                drawTexel(image, x, y, constants, PX_INSIDE, PX_OUTSIDE);
         }
-        return true;
     }
 
 private:
@@ -2565,6 +3197,37 @@ private:
         }
     }
 
+    // Narrows [begin, end] to the x at which the half-edge function c + nx * x is at least threshold.
+    static void clipSpan(float nx, float c, float threshold, float& begin, float& end)
+    {
+        if (nx > 0.0f)
+            begin = max(begin, (threshold - c) / nx);
+        else if (nx < 0.0f)
+            end = min(end, (threshold - c) / nx);
+        else if (c < threshold)
+            begin = end + 1.0f;
+    }
+
+    void drawTexel(BitImage* image, int x, int y, const float* constants, float inside, float outside) const
+    {
+        const Vector2 center((float)x + 0.5f, (float)y + 0.5f);
+        const float c1 = constants[0] + n1.x * center.x + n1.y * center.y;
+        const float c2 = constants[1] + n2.x * center.x + n2.y * center.y;
+        const float c3 = constants[2] + n3.x * center.x + n3.y * center.y;
+        if (c1 >= inside && c2 >= inside && c3 >= inside)
+        {
+            image->set((uint32_t)x, (uint32_t)y);
+        }
+        else if (c1 >= outside && c2 >= outside && c3 >= outside)
+        {
+            // triangle partially covers pixel. do clipping.
+            ClippedTriangle ct(v1 - center, v2 - center, v3 - center);
+            ct.clipAABox(-0.5, -0.5, 0.5, 0.5);
+            if (ct.area() > 0.0f)
+                image->set((uint32_t)x, (uint32_t)y);
+        }
+    }
+
     // compute unit inward normals for each edge.
     void computeUnitInwardNormals()
     {
@@ -2584,15 +3247,14 @@ private:
     Vector2 n1, n2, n3; // unit inward normals
 };
 
-// Process the given triangle. Returns false if rasterization was interrupted by the callback.
-static bool drawTriangle(const Vector2& extents, const Vector2 v[3], SamplingCallback cb, void* param)
+// Sets the texels of the image that the given triangle overlaps.
+static void drawTriangle(const Vector2 v[3], BitImage* image)
 {
     Triangle tri(v[0], v[1], v[2]);
     // @@ It would be nice to have a conservative drawing mode that enlarges the triangle extents by one texel and is able to handle degenerate triangles.
     // @@ Maybe the simplest thing to do would be raster triangle edges.
     if (tri.isValid())
-        return tri.drawAA(extents, cb, param);
-    return true;
+        tri.draw(image);
 }
 
 } // namespace raster
@@ -2673,17 +3335,19 @@ private:
 // Charts are found by floodfilling faces without crossing UV seams.
 struct SetUvMeshChartsTask
 {
-    SetUvMeshChartsTask(UvMesh* const mesh, const std::vector<std::vector<size_t>>& grouped_faces)
+    SetUvMeshChartsTask(UvMesh* const mesh, const uint32_t* chartFaces, const uint32_t* chartOffsets, uint32_t chartCount)
         : m_mesh(mesh)
-        , m_grouped_faces(grouped_faces)
-        , m_faceAssigned(m_mesh->indices.size() / 3)
+        , m_chartFaces(chartFaces)
+        , m_chartOffsets(chartOffsets)
+        , m_chartCount(chartCount)
+        , m_faceAssigned(m_mesh->indices.length / 3)
     {
     }
 
     void run()
     {
-        const uint32_t vertexCount = m_mesh->texcoords.size();
-        const uint32_t indexCount = m_mesh->indices.size();
+        const uint32_t vertexCount = m_mesh->texcoords.length;
+        const uint32_t indexCount = m_mesh->indices.length;
         const uint32_t faceCount = indexCount / 3;
 
         // A vertex can only be assigned to one chart.
@@ -2692,23 +3356,38 @@ struct SetUvMeshChartsTask
 
         // Assign charts
         m_faceAssigned.zeroOutMemory();
-        for (const std::vector<size_t>& face_group : m_grouped_faces)
+        m_mesh->charts.reserve(m_mesh->charts.size() + m_chartCount);
+        for (uint32_t c = 0; c < m_chartCount; c++)
         {
             const uint32_t chartIndex = m_mesh->charts.size();
             UvMeshChart* chart = XA_NEW(UvMeshChart);
             m_mesh->charts.push_back(chart);
             chart->material = 0;
+            // Most faces are accepted, so size the chart for all of them.
+            const uint32_t chartFaceCount = m_chartOffsets[c + 1] - m_chartOffsets[c];
+            chart->faces.reserve(chartFaceCount);
+            chart->indices.reserve(chartFaceCount * 3);
 
-            for (const size_t face_index : face_group)
+            for (uint32_t i = m_chartOffsets[c]; i < m_chartOffsets[c + 1]; i++)
             {
+                const uint32_t face_index = m_chartFaces[i];
                 if (canAddFaceToChart(chartIndex, face_index))
                 {
                     addFaceToChart(chartIndex, face_index);
                 }
+                else
+                {
+                    m_rejectedFaceCount++;
+                }
             }
         }
     }
 
+    uint32_t rejectedFaceCount() const
+    {
+        return m_rejectedFaceCount;
+    }
+
 private:
     // The chart at chartIndex doesn't have to exist yet.
     bool canAddFaceToChart(uint32_t chartIndex, uint32_t face) const
@@ -2717,7 +3396,7 @@ private:
             return false; // Already assigned to a chart.
         if (m_mesh->faceIgnore.get(face))
             return false; // Face is ignored (zero area or nan UVs).
-        if (! m_mesh->faceMaterials.isEmpty() && chartIndex < m_mesh->charts.size())
+        if (m_mesh->faceMaterials.length > 0 && chartIndex < m_mesh->charts.size())
         {
             if (m_mesh->faceMaterials[face] != m_mesh->charts[chartIndex]->material)
                 return false; // Materials don't match.
@@ -2745,8 +3424,11 @@ private:
     }
 
     UvMesh* const m_mesh;
-    const std::vector<std::vector<size_t>>& m_grouped_faces;
+    const uint32_t* m_chartFaces;
+    const uint32_t* m_chartOffsets;
+    uint32_t m_chartCount;
     BitArray m_faceAssigned;
+    uint32_t m_rejectedFaceCount = 0;
 };
 
 } // namespace segment
@@ -2765,10 +3447,8 @@ struct Chart
     Array<uint32_t> uniqueVertices;
     // bounding box
     Vector2 majorAxis, minorAxis, minCorner, maxCorner;
-    // Mesh only
-    const Array<uint32_t>* boundaryEdges;
     // UvMeshChart only
-    Array<uint32_t> faces;
+    ConstArrayView<uint32_t> faces;
 
     Vector2& uniqueVertexAt(uint32_t v)
     {
@@ -2780,6 +3460,60 @@ struct Chart
     }
 };
 
+// Options which the pack loop is specialized on. RuntimePackFlags reads them from the options, PackFlags has them as constants, so that the branches
+// which aren't taken and the work for the options which are off disappear from its instance.
+struct RuntimePackFlags
+{
+    static bool rotateCharts(const PackOptions& options)
+    {
+        return options.rotateCharts;
+    }
+    static bool blockAlign(const PackOptions& options)
+    {
+        return options.blockAlign;
+    }
+    static bool bruteForce(const PackOptions& options)
+    {
+        return options.bruteForce;
+    }
+    static bool bilinear(const PackOptions& options)
+    {
+        return options.bilinear;
+    }
+    static uint32_t padding(const PackOptions& options)
+    {
+        return options.padding;
+    }
+};
+
+template<bool RotateCharts, bool BlockAlign, bool BruteForce, bool Bilinear, bool Padding>
+struct PackFlags
+{
+    static bool rotateCharts(const PackOptions&)
+    {
+        return RotateCharts;
+    }
+    static bool blockAlign(const PackOptions&)
+    {
+        return BlockAlign;
+    }
+    static bool bruteForce(const PackOptions&)
+    {
+        return BruteForce;
+    }
+    static bool bilinear(const PackOptions&)
+    {
+        return Bilinear;
+    }
+    static uint32_t padding(const PackOptions& options)
+    {
+        return Padding ? options.padding : 0;
+    }
+};
+
+// The options of the default PackOptions, which are also the ones smartUnwrap packs with.
+typedef PackFlags<true, false, false, true, false> DefaultPackFlags;
+
 struct Atlas
 {
     ~Atlas()
@@ -2789,6 +3523,11 @@ struct Atlas
             m_bitImages[i]->~BitImage();
             XA_FREE(m_bitImages[i]);
         }
+        for (uint32_t i = 0; i < m_skylines.size(); i++)
+        {
+            m_skylines[i]->~Array();
+            XA_FREE(m_skylines[i]);
+        }
         for (uint32_t i = 0; i < m_charts.size(); i++)
         {
             m_charts[i]->~Chart();
@@ -2828,8 +3567,8 @@ struct Atlas
     void addUvMeshCharts(UvMeshInstance* mesh)
     {
         // Copy texcoords from mesh.
-        mesh->texcoords.resize(mesh->mesh->texcoords.size());
-        memcpy(mesh->texcoords.data(), mesh->mesh->texcoords.data(), mesh->texcoords.size() * sizeof(Vector2));
+        mesh->texcoords.resize(mesh->mesh->texcoords.length);
+        memcpy(mesh->texcoords.data(), mesh->mesh->texcoords.data, mesh->texcoords.size() * sizeof(Vector2));
         BitArray vertexUsed(mesh->texcoords.size());
         BoundingBox2D boundingBox;
         for (uint32_t c = 0; c < mesh->mesh->charts.size(); c++)
@@ -2840,9 +3579,7 @@ struct Atlas
             chart->material = uvChart->material;
             chart->indices = uvChart->indices;
             chart->vertices = mesh->texcoords;
-            chart->boundaryEdges = nullptr;
-            chart->faces.resize(uvChart->faces.size());
-            memcpy(chart->faces.data(), uvChart->faces.data(), sizeof(uint32_t) * uvChart->faces.size());
+            chart->faces = uvChart->faces;
             // Find unique vertices.
             vertexUsed.zeroOutMemory();
             for (uint32_t i = 0; i < chart->indices.length; i++)
@@ -2895,8 +3632,19 @@ struct Atlas
     }
 
     // Pack charts in the smallest possible rectangle.
-    bool packCharts(const PackOptions& options)
+    // The charts are rasterized on the task scheduler threads, into images allocated from chartImagesArena, which can be kept to be reused by the next call.
+    bool packCharts(const PackOptions& options, TaskScheduler* taskScheduler, Array<uint64_t>& chartImagesArena)
     {
+        if (options.rotateCharts && ! options.blockAlign && ! options.bruteForce && options.bilinear && options.padding == 0)
+            return packCharts<DefaultPackFlags>(options, taskScheduler, chartImagesArena);
+        return packCharts<RuntimePackFlags>(options, taskScheduler, chartImagesArena);
+    }
+
+private:
+    template<typename Flags>
+    bool packCharts(const PackOptions& options, TaskScheduler* taskScheduler, Array<uint64_t>& chartImagesArena)
+    {
+        m_taskScheduler = taskScheduler;
         const uint32_t chartCount = m_charts.size();
         XA_PRINT("Packing %u charts\n", chartCount);
         if (chartCount == 0)
@@ -2905,7 +3653,7 @@ struct Atlas
         }
         // Estimate resolution and/or texels per unit if not specified.
         m_texelsPerUnit = options.texelsPerUnit;
-        uint32_t resolution = options.resolution > 0 ? options.resolution + options.padding * 2 : 0;
+        uint32_t resolution = options.resolution > 0 ? options.resolution + Flags::padding(options) * 2 : 0;
         const uint32_t maxResolution = m_texelsPerUnit > 0.0f ? resolution : 0;
         if (resolution <= 0 || m_texelsPerUnit <= 0)
         {
@@ -2977,12 +3725,12 @@ struct Atlas
             if (extents.x > 0.0f && extents.y > 0.0f)
             {
                 // Block align: align all chart extents to 4x4 blocks, but taking padding and texel center offset into account.
-                const int blockAlignSizeOffset = options.padding * 2 + 1;
+                const int blockAlignSizeOffset = Flags::padding(options) * 2 + 1;
                 int width = ftoi_ceil(extents.x);
-                if (options.blockAlign)
+                if (Flags::blockAlign(options))
                     width = align(width + blockAlignSizeOffset, 4) - blockAlignSizeOffset;
                 int height = ftoi_ceil(extents.y);
-                if (options.blockAlign)
+                if (Flags::blockAlign(options))
                     height = align(height + blockAlignSizeOffset, 4) - blockAlignSizeOffset;
                 for (uint32_t v = 0; v < chart->uniqueVertexCount(); v++)
                 {
@@ -2999,7 +3747,7 @@ struct Atlas
             bool warnChartResized = false;
             if (maxResolution > 0 && (maxChartSize == 0 || maxResolution < maxChartSize))
             {
-                maxChartSize = maxResolution - options.padding * 2; // Don't include padding.
+                maxChartSize = maxResolution - Flags::padding(options) * 2; // Don't include padding.
                 warnChartResized = true;
             }
             if (maxChartSize > 0)
@@ -3022,8 +3770,8 @@ struct Atlas
             for (uint32_t v = 0; v < chart->uniqueVertexCount(); v++)
             {
                 Vector2& texcoord = chart->uniqueVertexAt(v);
-                texcoord.x += 0.5f + options.padding;
-                texcoord.y += 0.5f + options.padding;
+                texcoord.x += 0.5f + Flags::padding(options);
+                texcoord.y += 0.5f + Flags::padding(options);
                 extents = max(extents, texcoord);
             }
             if (extents.x > resolution || extents.y > resolution)
@@ -3041,80 +3789,34 @@ struct Atlas
         uint32_t currentChartBucket = 0;
         Array<Vector2i> chartStartPositions; // per atlas
         chartStartPositions.push_back(Vector2i(0, 0));
+        // The images of the charts don't depend on their placement, so rasterize all of them beforehand.
+        ChartImages* chartImages = XA_ALLOC_ARRAY(ChartImages, chartCount);
+        for (uint32_t c = 0; c < chartCount; c++)
+            new (&chartImages[c]) ChartImages();
+        rasterizeCharts<Flags>(options, chartExtents, ranks, taskScheduler, chartImagesArena, chartImages);
+        // The skylines are as wide as the atlas. If it's not limited, they are made for a square atlas, whose area is about the one of the bounding
+        // rectangles of the charts since the charts are moved down into the rectangles, but at least as wide as any chart.
+        int skylineWidth = (int)maxResolution;
+        if (options.strategy == PackStrategy::Skyline && maxResolution == 0)
+        {
+            uint64_t chartsArea = 0;
+            for (uint32_t c = 0; c < chartCount; c++)
+            {
+                const BitImage& image = chartImages[c].image;
+                chartsArea += (uint64_t)image.width() * image.height();
+                skylineWidth = max(skylineWidth, (int)(Flags::rotateCharts(options) ? min(image.width(), image.height()) : image.width()));
+            }
+            skylineWidth = max(skylineWidth, (int)ceilf(sqrtf((float)chartsArea)));
+        }
         // Pack sorted charts.
-        // chartImage: result from conservative rasterization
-        // chartImageBilinear: chartImage plus any texels that would be sampled by bilinear filtering.
-        // chartImagePadding: either chartImage or chartImageBilinear depending on options, with a dilate filter applied options.padding times.
-        // Rotated versions swap x and y.
-        BitImage chartImage, chartImageBilinear, chartImagePadding;
-        BitImage chartImageRotated, chartImageBilinearRotated, chartImagePaddingRotated;
-        UniformGrid2 boundaryEdgeGrid;
         Array<Vector2i> atlasSizes;
         atlasSizes.push_back(Vector2i(0, 0));
-        int progress = 0;
         for (uint32_t i = 0; i < chartCount; i++)
         {
             uint32_t c = ranks[chartCount - i - 1]; // largest chart first
             Chart* chart = m_charts[c];
-            // @@ Add special cases for dot and line charts. @@ Lightmap rasterizer also needs to handle these special cases.
-            // @@ We could also have a special case for chart quads. If the quad surface <= 4 texels, align vertices with texel centers and do not add padding. May be very useful
-            // for foliage.
-            // @@ In general we could reduce the padding of all charts by one texel by using a rasterizer that takes into account the 2-texel footprint of the tent bilinear filter.
-            // For example, if we have a chart that is less than 1 texel wide currently we add one texel to the left and one texel to the right creating a 3-texel-wide bitImage.
-            // However, if we know that the chart is only 1 texel wide we could align it so that it only touches the footprint of two texels:
-            //      |   |      <- Touches texels 0, 1 and 2.
-            //    |   |        <- Only touches texels 0 and 1.
-            // \   \ / \ /   /
-            //  \   X   X   /
-            //   \ / \ / \ /
-            //    V   V   V
-            //    0   1   2
-            // Resize and clear (discard = true) chart images.
-            // Leave room for padding at extents.
-            chartImage.resize(ftoi_ceil(chartExtents[c].x) + options.padding, ftoi_ceil(chartExtents[c].y) + options.padding, true);
-            if (options.rotateCharts)
-                chartImageRotated.resize(chartImage.height(), chartImage.width(), true);
-            if (options.bilinear)
-            {
-                chartImageBilinear.resize(chartImage.width(), chartImage.height(), true);
-                if (options.rotateCharts)
-                    chartImageBilinearRotated.resize(chartImage.height(), chartImage.width(), true);
-            }
-            // Rasterize chart faces.
-            const uint32_t faceCount = chart->indices.length / 3;
-            for (uint32_t f = 0; f < faceCount; f++)
-            {
-                Vector2 vertices[3];
-                for (uint32_t v = 0; v < 3; v++)
-                    vertices[v] = chart->vertices[chart->indices[f * 3 + v]];
-                DrawTriangleCallbackArgs args;
-                args.chartBitImage = &chartImage;
-                args.chartBitImageRotated = options.rotateCharts ? &chartImageRotated : nullptr;
-                raster::drawTriangle(Vector2((float)chartImage.width(), (float)chartImage.height()), vertices, drawTriangleCallback, &args);
-            }
-            // Expand chart by pixels sampled by bilinear interpolation.
-            if (options.bilinear)
-                bilinearExpand(chart, &chartImage, &chartImageBilinear, options.rotateCharts ? &chartImageBilinearRotated : nullptr, boundaryEdgeGrid);
-            // Expand chart by padding pixels (dilation).
-            if (options.padding > 0)
-            {
-                // Copy into the same BitImage instances for every chart to avoid reallocating BitImage buffers (largest chart is packed first).
-                if (options.bilinear)
-                    chartImageBilinear.copyTo(chartImagePadding);
-                else
-                    chartImage.copyTo(chartImagePadding);
-                chartImagePadding.dilate(options.padding);
-                if (options.rotateCharts)
-                {
-                    if (options.bilinear)
-                        chartImageBilinearRotated.copyTo(chartImagePaddingRotated);
-                    else
-                        chartImageRotated.copyTo(chartImagePaddingRotated);
-                    chartImagePaddingRotated.dilate(options.padding);
-                }
-            }
             // Update brute force bucketing.
-            if (options.bruteForce)
+            if (Flags::bruteForce(options))
             {
                 if (chartOrderArray[c] > minChartPerimeter && chartOrderArray[c] <= maxChartPerimeter - (chartPerimeterBucketSize * (currentChartBucket + 1)))
                 {
@@ -3125,22 +3827,8 @@ struct Atlas
                 }
             }
             // Find a location to place the chart in the atlas.
-            BitImage *chartImageToPack, *chartImageToPackRotated;
-            if (options.padding > 0)
-            {
-                chartImageToPack = &chartImagePadding;
-                chartImageToPackRotated = &chartImagePaddingRotated;
-            }
-            else if (options.bilinear)
-            {
-                chartImageToPack = &chartImageBilinear;
-                chartImageToPackRotated = &chartImageBilinearRotated;
-            }
-            else
-            {
-                chartImageToPack = &chartImage;
-                chartImageToPackRotated = &chartImageRotated;
-            }
+            BitImage* chartImageToPack = &chartImages[c].image;
+            BitImage* chartImageToPackRotated = &chartImages[c].imageRotated;
             uint32_t currentAtlas = 0;
             int best_x = 0, best_y = 0;
             int best_cw = 0, best_ch = 0;
@@ -3154,7 +3842,14 @@ struct Atlas
                 {
                     // Chart doesn't fit in the current bitImage, create a new one.
                     BitImage* bi = XA_NEW_ARGS(BitImage, resolution, resolution);
+                    bi->enableOccupancy();
                     m_bitImages.push_back(bi);
+                    if (options.strategy == PackStrategy::Skyline)
+                    {
+                        Array<SkylineSegment>* skyline = XA_NEW(Array<SkylineSegment>);
+                        skyline->push_back(SkylineSegment{ 0, 0, skylineWidth });
+                        m_skylines.push_back(skyline);
+                    }
                     atlasSizes.push_back(Vector2i(0, 0));
 #if XA_DEBUG
                     firstChartInBitImage = true;
@@ -3162,9 +3857,10 @@ struct Atlas
                     // Start positions are per-atlas, so create a new one of those too.
                     chartStartPositions.push_back(Vector2i(0, 0));
                 }
-                const bool foundLocation = findChartLocation(
+                const bool foundLocation = findChartLocation<Flags>(
                     options,
                     chartStartPositions[currentAtlas],
+                    options.strategy == PackStrategy::Skyline ? m_skylines[currentAtlas] : nullptr,
                     m_bitImages[currentAtlas],
                     chartImageToPack,
                     chartImageToPackRotated,
@@ -3189,7 +3885,7 @@ struct Atlas
                 currentAtlas++;
             }
             // Update brute force start location.
-            if (options.bruteForce)
+            if (Flags::bruteForce(options))
             {
                 // Reset start location if the chart expanded the atlas.
                 if (best_x + best_cw > atlasSizes[currentAtlas].x || best_y + best_ch > atlasSizes[currentAtlas].y)
@@ -3222,6 +3918,8 @@ struct Atlas
                 XA_DEBUG_ASSERT(atlasSizes[currentAtlas].y <= (int)maxResolution);
             }
             addChart(m_bitImages[currentAtlas], chartImageToPack, chartImageToPackRotated, atlasSizes[currentAtlas].x, atlasSizes[currentAtlas].y, best_x, best_y, best_r);
+            if (options.strategy == PackStrategy::Skyline)
+                updateSkyline(*m_skylines[currentAtlas], best_x, best_cw, best_y + best_ch);
             chart->atlasIndex = (int32_t)currentAtlas;
             // Modify texture coordinates:
             //  - rotate if the chart should be rotated
@@ -3233,26 +3931,29 @@ struct Atlas
                 Vector2 t = texcoord;
                 if (best_r)
                 {
-                    XA_DEBUG_ASSERT(options.rotateCharts);
+                    XA_DEBUG_ASSERT(Flags::rotateCharts(options));
                     swap(t.x, t.y);
                 }
                 texcoord.x = best_x + t.x;
                 texcoord.y = best_y + t.y;
-                texcoord.x -= (float)options.padding;
-                texcoord.y -= (float)options.padding;
+                texcoord.x -= (float)Flags::padding(options);
+                texcoord.y -= (float)Flags::padding(options);
                 XA_ASSERT(texcoord.x >= 0 && texcoord.y >= 0);
                 XA_ASSERT(isFinite(texcoord.x) && isFinite(texcoord.y));
             }
         }
+        for (uint32_t c = 0; c < chartCount; c++)
+            chartImages[c].~ChartImages();
+        XA_FREE(chartImages);
         // Remove padding from outer edges.
         if (maxResolution == 0)
         {
-            m_width = max(0, atlasSizes[0].x - (int)options.padding * 2);
-            m_height = max(0, atlasSizes[0].y - (int)options.padding * 2);
+            m_width = max(0, atlasSizes[0].x - (int)Flags::padding(options) * 2);
+            m_height = max(0, atlasSizes[0].y - (int)Flags::padding(options) * 2);
         }
         else
         {
-            m_width = m_height = maxResolution - (int)options.padding * 2;
+            m_width = m_height = maxResolution - (int)Flags::padding(options) * 2;
         }
         XA_PRINT("   %dx%d resolution\n", m_width, m_height);
         m_utilization.resize(m_bitImages.size());
@@ -3282,10 +3983,17 @@ struct Atlas
         return true;
     }
 
-private:
+    // Horizontal segment of a skyline, which is the top of the bounding rectangles of the charts placed in an atlas, from left to right.
+    struct SkylineSegment
+    {
+        int x, y, width;
+    };
+
+    template<typename Flags>
     bool findChartLocation(
         const PackOptions& options,
         const Vector2i& startPosition,
+        const Array<SkylineSegment>* skyline,
         const BitImage* atlasBitImage,
         const BitImage* chartBitImage,
         const BitImage* chartBitImageRotated,
@@ -3298,9 +4006,11 @@ private:
         int* best_r,
         uint32_t maxResolution)
     {
+        if (skyline)
+            return findChartLocation_skyline<Flags>(options, *skyline, atlasBitImage, chartBitImage, chartBitImageRotated, best_x, best_y, best_w, best_h, best_r, maxResolution);
         const int attempts = 4096;
-        if (options.bruteForce || attempts >= w * h)
-            return findChartLocation_bruteForce(
+        if (Flags::bruteForce(options) || attempts >= w * h)
+            return findChartLocation_bruteForce<Flags>(
                 options,
                 startPosition,
                 atlasBitImage,
@@ -3314,9 +4024,222 @@ private:
                 best_h,
                 best_r,
                 maxResolution);
-        return findChartLocation_random(options, atlasBitImage, chartBitImage, chartBitImageRotated, w, h, best_x, best_y, best_w, best_h, best_r, attempts, maxResolution);
+        return findChartLocation_random<Flags>(options, atlasBitImage, chartBitImage, chartBitImageRotated, w, h, best_x, best_y, best_w, best_h, best_r, attempts, maxResolution);
     }
 
+    static const uint32_t kChartLocationProbeCount = 8;
+
+    // Location of a chart in the atlas, which is the best one found among a slice of the candidate locations.
+    struct ChartLocation
+    {
+        int x = 0, y = 0, w = 0, h = 0, r = 0;
+        int metric = INT_MAX;
+        uint32_t candidate = UINT32_MAX; // Index of the random candidate
+        bool inside = false; // The chart doesn't extend the atlas, in which case no later candidate is looked at.
+    };
+
+    struct RandomCandidate
+    {
+        int x, y, r;
+        bool valid;
+        KISSRng nextRand; // State of the random generator after drawing the candidate
+    };
+
+    // The candidate locations are split into slices, which are searched in parallel. The best location of each slice is then reduced in the order of
+    // the slices, with the same rules as a serial search, so that the result doesn't depend on the number of threads.
+    struct ChartLocationSearch
+    {
+        const PackOptions* options;
+        const BitImage* atlasBitImage;
+        const BitImage* chartBitImage;
+        const BitImage* chartBitImageRotated;
+        int w, h;
+        uint32_t maxResolution;
+        // Texels set in the chart and rotated chart, to skip the locations where they land on full blocks of the atlas before testing all the texels.
+        Vector2i probes[2][kChartLocationProbeCount];
+        uint32_t probeCount[2];
+        // Brute force: the rows of candidates, first all the ones of the non-rotated chart and then all the ones of the rotated chart.
+        Vector2i startPosition;
+        int stepSize;
+        uint32_t rowCount[2];
+        // Random: the current batch of candidates, and the index of its first one.
+        const RandomCandidate* candidates;
+        uint32_t candidatesOffset;
+        // Best metric found by any slice, used to skip the candidates which can't be the best of all. The actual best location only depends on
+        // the order of the slices.
+        std::atomic<int> bestMetric;
+        bool random;
+    };
+
+    struct ChartLocationSlice
+    {
+        uint32_t begin, end; // Range of rows or random candidates
+        ChartLocation location;
+    };
+
+    template<typename Flags>
+    static void searchChartLocationRows(ChartLocationSearch& search, ChartLocationSlice& slice)
+    {
+        // Work on copies, so that the compiler can keep them in registers.
+        ChartLocation best = slice.location;
+        const int w = search.w, h = search.h;
+        const int stepSize = Flags::blockAlign(*search.options) ? 4 : 1;
+        const int maxResolution = (int)search.maxResolution;
+        for (uint32_t row = slice.begin; row < slice.end && ! best.inside; row++)
+        {
+            const int r = row < search.rowCount[0] ? 0 : 1;
+            const int y = search.startPosition.y + (int)(r == 0 ? row : row - search.rowCount[0]) * stepSize;
+            const BitImage* chartBitImage = r == 1 ? search.chartBitImageRotated : search.chartBitImage;
+            const int cw = chartBitImage->width();
+            const int ch = chartBitImage->height();
+            for (int x = (y == search.startPosition.y ? search.startPosition.x : 0); x <= w + stepSize; x += stepSize)
+            {
+                if (maxResolution > 0 && x > maxResolution - cw)
+                    break;
+                // Early out if metric is not better.
+                const int extentX = max(w, x + cw), extentY = max(h, y + ch);
+                const int area = extentX * extentY;
+                const int extents = max(extentX, extentY);
+                const int metric = extents * extents + area;
+                if (metric > best.metric)
+                    continue;
+                // If metric is the same, pick the one closest to the origin.
+                if (metric == best.metric && max(x, y) >= max(best.x, best.y))
+                    continue;
+                if (metric > search.bestMetric.load(std::memory_order_relaxed) || search.atlasBitImage->hitsFullBlock(search.probes[r], search.probeCount[r], x, y)
+                    || ! search.atlasBitImage->canBlit(*chartBitImage, x, y))
+                    continue;
+                best.metric = metric;
+                best.x = x;
+                best.y = y;
+                best.w = cw;
+                best.h = ch;
+                best.r = r;
+                if (area == w * h)
+                {
+                    best.inside = true; // Chart is completely inside, do not look at any other location.
+                    break;
+                }
+                updateBestMetric(search, metric);
+            }
+        }
+        slice.location = best;
+    }
+
+    template<typename Flags>
+    static void searchChartLocationCandidates(ChartLocationSearch& search, ChartLocationSlice& slice)
+    {
+        // Work on copies, so that the compiler can keep them in registers.
+        ChartLocation best = slice.location;
+        const int w = search.w, h = search.h;
+        for (uint32_t i = slice.begin; i < slice.end; i++)
+        {
+            const RandomCandidate& candidate = search.candidates[i - search.candidatesOffset];
+            if (! candidate.valid)
+                continue;
+            const int x = candidate.x, y = candidate.y;
+            const BitImage* chartBitImage = candidate.r == 1 ? search.chartBitImageRotated : search.chartBitImage;
+            const int cw = chartBitImage->width();
+            const int ch = chartBitImage->height();
+            // Early out.
+            const int area = max(w, x + cw) * max(h, y + ch);
+            const int extents = max(max(w, x + cw), max(h, y + ch));
+            const int metric = extents * extents + area;
+            if (metric > best.metric)
+                continue;
+            if (metric == best.metric && min(x, y) > min(best.x, best.y))
+                continue; // If metric is the same, pick the one closest to the origin.
+            if (metric > search.bestMetric.load(std::memory_order_relaxed) || search.atlasBitImage->hitsFullBlock(search.probes[candidate.r], search.probeCount[candidate.r], x, y)
+                || ! search.atlasBitImage->canBlit(*chartBitImage, x, y))
+                continue;
+            best.metric = metric;
+            best.x = x;
+            best.y = y;
+            best.w = cw;
+            best.h = ch;
+            best.r = Flags::rotateCharts(*search.options) ? candidate.r : 0;
+            best.candidate = i;
+            if (area == w * h)
+            {
+                best.inside = true; // Chart is completely inside, do not look at any other location.
+                break;
+            }
+            updateBestMetric(search, metric);
+        }
+        slice.location = best;
+    }
+
+    // Small charts are rejected as fast by canBlit() as by the probes, so they don't have any.
+    template<typename Flags>
+    static void sampleChartLocationProbes(ChartLocationSearch& search)
+    {
+        for (int r = 0; r < 2; r++)
+        {
+            const BitImage* chartBitImage = r == 1 ? search.chartBitImageRotated : search.chartBitImage;
+            search.probeCount[r] = 0;
+            if ((r == 0 || Flags::rotateCharts(*search.options)) && ! chartBitImage->isSingleWord())
+                search.probeCount[r] = chartBitImage->sampleSetTexels(search.probes[r], kChartLocationProbeCount);
+        }
+    }
+
+    static void updateBestMetric(ChartLocationSearch& search, int metric)
+    {
+        int bestMetric = search.bestMetric.load(std::memory_order_relaxed);
+        while (metric < bestMetric && ! search.bestMetric.compare_exchange_weak(bestMetric, metric, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    template<typename Flags>
+    static void runSearchChartLocationTask(void* groupUserData, void* taskUserData)
+    {
+        auto search = (ChartLocationSearch*)groupUserData;
+        auto slice = (ChartLocationSlice*)taskUserData;
+        if (search->random)
+            searchChartLocationCandidates<Flags>(*search, *slice);
+        else
+            searchChartLocationRows<Flags>(*search, *slice);
+    }
+
+    // Splits count rows or candidates into slices, and searches them. workPerItem estimates the cost of a single item, to only use threads when it's worth it.
+    // Returns the best location of each slice, in order, which is initialized to the best one found by the previous searches.
+    template<typename Flags>
+    ArrayView<ChartLocationSlice> searchChartLocation(ChartLocationSearch& search, uint32_t count, uint32_t workPerItem, const ChartLocation& best)
+    {
+        const uint64_t kMinWorkPerSlice = 1 << 16;
+        const uint32_t threadCount = m_taskScheduler ? m_taskScheduler->threadCount() : 1;
+        uint32_t sliceCount = 1;
+        if (threadCount > 1)
+            sliceCount = (uint32_t)min((uint64_t)count, min((uint64_t)threadCount * 4, (uint64_t)count * workPerItem / kMinWorkPerSlice));
+        sliceCount = max(1u, sliceCount);
+        m_chartLocationSlices.resize(sliceCount);
+        for (uint32_t i = 0; i < sliceCount; i++)
+        {
+            ChartLocationSlice& slice = m_chartLocationSlices[i];
+            slice.begin = search.candidatesOffset + (uint32_t)((uint64_t)count * i / sliceCount);
+            slice.end = search.candidatesOffset + (uint32_t)((uint64_t)count * (i + 1) / sliceCount);
+            slice.location = best;
+        }
+        if (sliceCount == 1)
+        {
+            runSearchChartLocationTask<Flags>(&search, &m_chartLocationSlices[0]);
+        }
+        else
+        {
+            TaskGroupHandle taskGroup = m_taskScheduler->createTaskGroup(&search, sliceCount);
+            for (uint32_t i = 0; i < sliceCount; i++)
+            {
+                Task task;
+                task.userData = &m_chartLocationSlices[i];
+                task.func = runSearchChartLocationTask<Flags>;
+                m_taskScheduler->run(taskGroup, task);
+            }
+            m_taskScheduler->wait(&taskGroup);
+        }
+        return ArrayView<ChartLocationSlice>(m_chartLocationSlices.data(), sliceCount);
+    }
+
+    template<typename Flags>
     bool findChartLocation_bruteForce(
         const PackOptions& options,
         const Vector2i& startPosition,
@@ -3332,54 +4255,94 @@ private:
         int* best_r,
         uint32_t maxResolution)
     {
-        const int stepSize = options.blockAlign ? 4 : 1;
-        int best_metric = INT_MAX;
+        ChartLocationSearch search;
+        search.options = &options;
+        search.atlasBitImage = atlasBitImage;
+        search.chartBitImage = chartBitImage;
+        search.chartBitImageRotated = chartBitImageRotated;
+        search.w = w;
+        search.h = h;
+        search.maxResolution = maxResolution;
+        sampleChartLocationProbes<Flags>(search);
+        search.startPosition = startPosition;
+        search.stepSize = Flags::blockAlign(options) ? 4 : 1;
+        search.candidates = nullptr;
+        search.candidatesOffset = 0;
+        search.bestMetric = INT_MAX;
+        search.random = false;
         // Try two different orientations.
         for (int r = 0; r < 2; r++)
         {
-            int cw = chartBitImage->width();
-            int ch = chartBitImage->height();
-            if (r == 1)
+            search.rowCount[r] = 0;
+            if (r == 1 && ! Flags::rotateCharts(options))
+                break;
+            const int ch = r == 1 ? chartBitImage->width() : chartBitImage->height();
+            for (int y = startPosition.y; y <= h + search.stepSize; y += search.stepSize)
             {
-                if (options.rotateCharts)
-                    swap(cw, ch);
-                else
+                if (maxResolution > 0 && y > (int)maxResolution - ch)
                     break;
+                search.rowCount[r]++;
             }
-            for (int y = startPosition.y; y <= h + stepSize; y += stepSize)
+        }
+        const uint32_t rowWork = (uint32_t)(w / search.stepSize + 2) * chartBitImage->height();
+        const ArrayView<ChartLocationSlice> slices = searchChartLocation<Flags>(search, search.rowCount[0] + search.rowCount[1], rowWork, ChartLocation());
+        // The first location inside the atlas is taken, otherwise the first one with the best metric and closest to the origin.
+        ChartLocation best;
+        for (uint32_t i = 0; i < slices.length; i++)
+        {
+            const ChartLocation& location = slices[i].location;
+            if (location.inside)
             {
-                if (maxResolution > 0 && y > (int)maxResolution - ch)
-                    break;
-                for (int x = (y == startPosition.y ? startPosition.x : 0); x <= w + stepSize; x += stepSize)
-                {
-                    if (maxResolution > 0 && x > (int)maxResolution - cw)
-                        break;
-                    // Early out if metric is not better.
-                    const int extentX = max(w, x + cw), extentY = max(h, y + ch);
-                    const int area = extentX * extentY;
-                    const int extents = max(extentX, extentY);
-                    const int metric = extents * extents + area;
-                    if (metric > best_metric)
-                        continue;
-                    // If metric is the same, pick the one closest to the origin.
-                    if (metric == best_metric && max(x, y) >= max(*best_x, *best_y))
-                        continue;
-                    if (! atlasBitImage->canBlit(r == 1 ? *chartBitImageRotated : *chartBitImage, x, y))
-                        continue;
-                    best_metric = metric;
-                    *best_x = x;
-                    *best_y = y;
-                    *best_w = cw;
-                    *best_h = ch;
-                    *best_r = r;
-                    if (area == w * h)
-                        return true; // Chart is completely inside, do not look at any other location.
-                }
+                best = location;
+                break;
             }
+            if (location.metric < best.metric || (location.metric == best.metric && max(location.x, location.y) < max(best.x, best.y)))
+                best = location;
         }
-        return best_metric != INT_MAX;
+        if (best.metric == INT_MAX)
+            return false;
+        *best_x = best.x;
+        *best_y = best.y;
+        *best_w = best.w;
+        *best_h = best.h;
+        *best_r = best.r;
+        return true;
     }
 
+    template<typename Flags>
+    RandomCandidate generateRandomCandidate(KISSRng& rand, const PackOptions& options, const BitImage* chartBitImage, int w, int h, uint32_t maxResolution) const
+    {
+        const int BLOCK_SIZE = 4;
+        int cw = chartBitImage->width();
+        int ch = chartBitImage->height();
+        RandomCandidate candidate;
+        candidate.r = Flags::rotateCharts(options) ? rand.getRange(1) : 0;
+        if (candidate.r == 1)
+            swap(cw, ch);
+        // + 1 to extend atlas in case atlas full. We may want to use a higher number to increase probability of extending atlas.
+        int xRange = w + 1;
+        int yRange = h + 1;
+        // Clamp to max resolution.
+        if (maxResolution > 0)
+        {
+            xRange = min(xRange, (int)maxResolution - cw);
+            yRange = min(yRange, (int)maxResolution - ch);
+        }
+        candidate.x = rand.getRange(xRange);
+        candidate.y = rand.getRange(yRange);
+        candidate.valid = true;
+        candidate.nextRand = rand;
+        if (Flags::blockAlign(options))
+        {
+            candidate.x = align(candidate.x, BLOCK_SIZE);
+            candidate.y = align(candidate.y, BLOCK_SIZE);
+            if (maxResolution > 0 && (candidate.x > (int)maxResolution - cw || candidate.y > (int)maxResolution - ch))
+                candidate.valid = false; // Block alignment pushed the chart outside the atlas.
+        }
+        return candidate;
+    }
+
+    template<typename Flags>
     bool findChartLocation_random(
         const PackOptions& options,
         const BitImage* atlasBitImage,
@@ -3395,65 +4358,158 @@ private:
         int attempts,
         uint32_t maxResolution)
     {
-        bool result = false;
-        const int BLOCK_SIZE = 4;
-        int best_metric = INT_MAX;
-        for (int i = 0; i < attempts; i++)
-        {
-            int cw = chartBitImage->width();
-            int ch = chartBitImage->height();
-            int r = options.rotateCharts ? m_rand.getRange(1) : 0;
-            if (r == 1)
-                swap(cw, ch);
-            // + 1 to extend atlas in case atlas full. We may want to use a higher number to increase probability of extending atlas.
-            int xRange = w + 1;
-            int yRange = h + 1;
-            // Clamp to max resolution.
-            if (maxResolution > 0)
-            {
-                xRange = min(xRange, (int)maxResolution - cw);
-                yRange = min(yRange, (int)maxResolution - ch);
-            }
-            int x = m_rand.getRange(xRange);
-            int y = m_rand.getRange(yRange);
-            if (options.blockAlign)
-            {
-                x = align(x, BLOCK_SIZE);
-                y = align(y, BLOCK_SIZE);
-                if (maxResolution > 0 && (x > (int)maxResolution - cw || y > (int)maxResolution - ch))
-                    continue; // Block alignment pushed the chart outside the atlas.
+        ChartLocationSearch search;
+        search.options = &options;
+        search.atlasBitImage = atlasBitImage;
+        search.chartBitImage = chartBitImage;
+        search.chartBitImageRotated = chartBitImageRotated;
+        search.w = w;
+        search.h = h;
+        search.maxResolution = maxResolution;
+        sampleChartLocationProbes<Flags>(search);
+        search.bestMetric = INT_MAX;
+        search.random = true;
+        // The candidates are drawn and searched in batches, which grow since small charts usually find a location inside the atlas early.
+        // The random generator is then left in the state where a serial search would have stopped.
+        ChartLocation best;
+        int batchSize = 64;
+        for (int batchStart = 0; batchStart < attempts && ! best.inside; batchStart += batchSize, batchSize *= 2)
+        {
+            const int batchCount = min(batchSize, attempts - batchStart);
+            m_randomCandidates.resize(batchCount);
+            for (int i = 0; i < batchCount; i++)
+                m_randomCandidates[i] = generateRandomCandidate<Flags>(m_rand, options, chartBitImage, w, h, maxResolution);
+            search.candidates = m_randomCandidates.data();
+            search.candidatesOffset = (uint32_t)batchStart;
+            const ArrayView<ChartLocationSlice> slices = searchChartLocation<Flags>(search, (uint32_t)batchCount, chartBitImage->height(), best);
+            // The first location inside the atlas is taken, otherwise the last one with the best metric and closest to the origin. The slices
+            // which found nothing in this batch still hold the best location of the previous batches, which has already been reduced.
+            for (uint32_t i = 0; i < slices.length; i++)
+            {
+                const ChartLocation& location = slices[i].location;
+                if (location.candidate == UINT32_MAX || location.candidate < (uint32_t)batchStart)
+                    continue;
+                if (location.inside)
+                {
+                    best = location;
+                    m_rand = m_randomCandidates[location.candidate - batchStart].nextRand;
+                    break;
+                }
+                if (location.metric < best.metric || (location.metric == best.metric && min(location.x, location.y) <= min(best.x, best.y)))
+                    best = location;
             }
-            // Early out.
-            int area = max(w, x + cw) * max(h, y + ch);
-            // int perimeter = max(w, x+cw) + max(h, y+ch);
-            int extents = max(max(w, x + cw), max(h, y + ch));
-            int metric = extents * extents + area;
-            if (metric > best_metric)
+        }
+        if (best.metric == INT_MAX)
+            return false;
+        *best_x = best.x;
+        *best_y = best.y;
+        *best_w = best.w;
+        *best_h = best.h;
+        *best_r = best.r;
+        return true;
+    }
+
+    // Places the bounding rectangle of the chart where its top is the lowest on the skyline, then moves the chart down as long as its texels
+    // don't overlap the ones of the atlas, since the charts don't fill their rectangles.
+    template<typename Flags>
+    bool findChartLocation_skyline(
+        const PackOptions& options,
+        const Array<SkylineSegment>& skyline,
+        const BitImage* atlasBitImage,
+        const BitImage* chartBitImage,
+        const BitImage* chartBitImageRotated,
+        int* best_x,
+        int* best_y,
+        int* best_w,
+        int* best_h,
+        int* best_r,
+        uint32_t maxResolution)
+    {
+        const int BLOCK_SIZE = 4;
+        const int stepSize = Flags::blockAlign(options) ? BLOCK_SIZE : 1;
+        const int skylineWidth = skyline.back().x + skyline.back().width;
+        int bestTop = INT_MAX, bestX = 0, bestY = 0, bestR = 0;
+        for (int r = 0; r < 2; r++)
+        {
+            if (r == 1 && ! Flags::rotateCharts(options))
+                break;
+            const BitImage* chartBitImage_r = r == 1 ? chartBitImageRotated : chartBitImage;
+            const int cw = chartBitImage_r->width();
+            const int ch = chartBitImage_r->height();
+            for (uint32_t i = 0; i < skyline.size(); i++)
             {
-                continue;
+                const int x = Flags::blockAlign(options) ? align(skyline[i].x, BLOCK_SIZE) : skyline[i].x;
+                if (x + cw > skylineWidth)
+                    break;
+                // The chart rests on the highest segment under it.
+                int y = 0;
+                for (uint32_t j = i; j < skyline.size() && skyline[j].x < x + cw && y + ch <= bestTop; j++)
+                    y = max(y, skyline[j].y);
+                if (Flags::blockAlign(options))
+                    y = align(y, BLOCK_SIZE);
+                if (maxResolution > 0 && y + ch > (int)maxResolution)
+                    continue;
+                if (y + ch < bestTop || (y + ch == bestTop && x < bestX))
+                {
+                    bestTop = y + ch;
+                    bestX = x;
+                    bestY = y;
+                    bestR = r;
+                }
             }
-            if (metric == best_metric && min(x, y) > min(*best_x, *best_y))
+        }
+        if (bestTop == INT_MAX)
+            return false;
+        const BitImage* chartBitImage_r = bestR == 1 ? chartBitImageRotated : chartBitImage;
+        while (bestY >= stepSize && atlasBitImage->canBlit(*chartBitImage_r, (uint32_t)bestX, (uint32_t)(bestY - stepSize)))
+            bestY -= stepSize;
+        *best_x = bestX;
+        *best_y = bestY;
+        *best_w = (int)chartBitImage_r->width();
+        *best_h = (int)chartBitImage_r->height();
+        *best_r = bestR;
+        return true;
+    }
+
+    // Raises the skyline to top over the chart at x. The skyline never goes down, since a chart moved under it can leave texels above its top.
+    void updateSkyline(Array<SkylineSegment>& skyline, int x, int width, int top)
+    {
+        const int end = x + width;
+        m_skylineScratch.clear();
+        for (uint32_t i = 0; i < skyline.size(); i++)
+        {
+            const SkylineSegment& segment = skyline[i];
+            if (segment.x < end && segment.x + segment.width > x)
+                top = max(top, segment.y);
+        }
+        bool inserted = false;
+        for (uint32_t i = 0; i < skyline.size(); i++)
+        {
+            const SkylineSegment segment = skyline[i];
+            const int segmentEnd = segment.x + segment.width;
+            if (segment.x < x)
+                pushSkylineSegment(SkylineSegment{ segment.x, segment.y, min(segmentEnd, x) - segment.x });
+            if (! inserted && segmentEnd > x)
             {
-                // If metric is the same, pick the one closest to the origin.
-                continue;
+                pushSkylineSegment(SkylineSegment{ x, top, width });
+                inserted = true;
             }
-            if (atlasBitImage->canBlit(r == 1 ? *chartBitImageRotated : *chartBitImage, x, y))
+            if (segmentEnd > end)
             {
-                result = true;
-                best_metric = metric;
-                *best_x = x;
-                *best_y = y;
-                *best_w = cw;
-                *best_h = ch;
-                *best_r = options.rotateCharts ? r : 0;
-                if (area == w * h)
-                {
-                    // Chart is completely inside, do not look at any other location.
-                    break;
-                }
+                const int begin = max(segment.x, end);
+                pushSkylineSegment(SkylineSegment{ begin, segment.y, segmentEnd - begin });
             }
         }
-        return result;
+        m_skylineScratch.copyTo(skyline);
+    }
+
+    // Appends a segment to the skyline being built, merged with the previous one if they are at the same height.
+    void pushSkylineSegment(const SkylineSegment& segment)
+    {
+        if (! m_skylineScratch.isEmpty() && m_skylineScratch.back().y == segment.y)
+            m_skylineScratch[m_skylineScratch.size() - 1].width += segment.width;
+        else
+            m_skylineScratch.push_back(segment);
     }
 
     void addChart(BitImage* atlasBitImage, const BitImage* chartBitImage, const BitImage* chartBitImageRotated, int atlas_w, int atlas_h, int offset_x, int offset_y, int r)
@@ -3484,47 +4540,242 @@ private:
                 }
             }
         }
+        atlasBitImage->updateOccupancy((uint32_t)max(0, offset_x), (uint32_t)max(0, offset_y), (uint32_t)w, (uint32_t)h);
     }
 
-    void bilinearExpand(const Chart* chart, BitImage* source, BitImage* dest, BitImage* destRotated, UniformGrid2& boundaryEdgeGrid) const
+    // Image of a chart to be packed, which is either chartImage or chartImageBilinear depending on options, dilated options.padding times.
+    // chartImage: result from conservative rasterization
+    // chartImageBilinear: chartImage plus any texels that would be sampled by bilinear filtering.
+    // The rotated version swaps x and y, and is only set if options.rotateCharts.
+    struct ChartImages
     {
-        boundaryEdgeGrid.reset(chart->vertices, chart->indices);
-        if (chart->boundaryEdges)
+        BitImage image;
+        BitImage imageRotated;
+    };
+
+    struct RasterizeChartScratch
+    {
+        BitImage chartImage;
+        BitImage neighbours; // Texels next to the chart image, which bilinear filtering may sample
+        Array<uint64_t> rows;
+        UniformGrid2 boundaryEdgeGrid;
+        Array<uint32_t> boundaryEdges;
+        Array<uint32_t> edgeSlots; // Open addressing hash table of the edges, by the positions of their vertices
+        Array<uint32_t> edgeOpposites;
+    };
+
+    struct RasterizeChartsGroupArgs
+    {
+        const Atlas* atlas;
+        const PackOptions* options;
+        const uint32_t* ranks;
+        uint32_t chartCount;
+        uint32_t taskCount;
+        ChartImages* chartImages;
+        ThreadLocal<RasterizeChartScratch>* scratch;
+    };
+
+    template<typename Flags>
+    static void runRasterizeChartsTask(void* groupUserData, void* taskUserData)
+    {
+        auto args = (RasterizeChartsGroupArgs*)groupUserData;
+        const uint32_t firstChart = *(const uint32_t*)taskUserData;
+        RasterizeChartScratch& scratch = args->scratch->get();
+        // Charts are sorted by size, so taking every taskCount-th chart, largest first, gives about the same amount of work to each task.
+        for (uint32_t i = firstChart; i < args->chartCount; i += args->taskCount)
         {
-            const uint32_t edgeCount = chart->boundaryEdges->size();
-            for (uint32_t i = 0; i < edgeCount; i++)
-                boundaryEdgeGrid.append((*chart->boundaryEdges)[i]);
+            const uint32_t c = args->ranks[args->chartCount - i - 1];
+            args->atlas->template rasterizeChart<Flags>(*args->options, args->atlas->m_charts[c], scratch, args->chartImages[c]);
         }
-        else
+    }
+
+    template<typename Flags>
+    void rasterizeCharts(
+        const PackOptions& options,
+        const Array<Vector2>& chartExtents,
+        const uint32_t* ranks,
+        TaskScheduler* taskScheduler,
+        Array<uint64_t>& chartImagesArena,
+        ChartImages* chartImages) const
+    {
+        const uint32_t chartCount = m_charts.size();
+        // Leave room for padding at extents.
+        Array<Vector2i> chartSizes;
+        chartSizes.resize(chartCount);
+        uint32_t arenaSize = 0;
+        for (uint32_t c = 0; c < chartCount; c++)
         {
-            for (uint32_t i = 0; i < chart->indices.length; i++)
-                boundaryEdgeGrid.append(i);
+            chartSizes[c] = Vector2i(ftoi_ceil(chartExtents[c].x) + Flags::padding(options), ftoi_ceil(chartExtents[c].y) + Flags::padding(options));
+            arenaSize += BitImage::wordCount(chartSizes[c].x, chartSizes[c].y);
+            if (Flags::rotateCharts(options))
+                arenaSize += BitImage::wordCount(chartSizes[c].y, chartSizes[c].x);
         }
-        const int xOffsets[] = { -1, 0, 1, -1, 1, -1, 0, 1 };
-        const int yOffsets[] = { -1, -1, -1, 0, 0, 1, 1, 1 };
-        for (uint32_t y = 0; y < source->height(); y++)
+        // The arena is only ever grown, the charts clear their images themselves.
+        if (arenaSize > chartImagesArena.size())
+            chartImagesArena.resize(arenaSize);
+        uint64_t* words = chartImagesArena.data();
+        for (uint32_t c = 0; c < chartCount; c++)
         {
-            for (uint32_t x = 0; x < source->width(); x++)
+            chartImages[c].image.setStorage(chartSizes[c].x, chartSizes[c].y, words);
+            words += BitImage::wordCount(chartSizes[c].x, chartSizes[c].y);
+            if (Flags::rotateCharts(options))
             {
-                // Copy pixels from source.
-                if (source->get(x, y))
-                    goto setPixel;
-                // Empty pixel. If none of of the surrounding pixels are set, this pixel can't be sampled by bilinear interpolation.
+                chartImages[c].imageRotated.setStorage(chartSizes[c].y, chartSizes[c].x, words);
+                words += BitImage::wordCount(chartSizes[c].y, chartSizes[c].x);
+            }
+        }
+        ThreadLocal<RasterizeChartScratch> scratch(taskScheduler);
+        RasterizeChartsGroupArgs args;
+        args.atlas = this;
+        args.options = &options;
+        args.ranks = ranks;
+        args.chartCount = chartCount;
+        args.taskCount = min(chartCount, taskScheduler->threadCount() * 4);
+        args.chartImages = chartImages;
+        args.scratch = &scratch;
+        Array<uint32_t> firstCharts;
+        firstCharts.resize(args.taskCount);
+        TaskGroupHandle taskGroup = taskScheduler->createTaskGroup(&args, args.taskCount);
+        for (uint32_t t = 0; t < args.taskCount; t++)
+        {
+            firstCharts[t] = t;
+            Task task;
+            task.userData = &firstCharts[t];
+            task.func = runRasterizeChartsTask<Flags>;
+            taskScheduler->run(taskGroup, task);
+        }
+        taskScheduler->wait(&taskGroup);
+    }
+
+    template<typename Flags>
+    void rasterizeChart(const PackOptions& options, const Chart* chart, RasterizeChartScratch& scratch, ChartImages& chartImages) const
+    {
+        // @@ Add special cases for dot and line charts. @@ Lightmap rasterizer also needs to handle these special cases.
+        // @@ We could also have a special case for chart quads. If the quad surface <= 4 texels, align vertices with texel centers and do not add padding. May be very useful
+        // for foliage.
+        // @@ In general we could reduce the padding of all charts by one texel by using a rasterizer that takes into account the 2-texel footprint of the tent bilinear filter.
+        // For example, if we have a chart that is less than 1 texel wide currently we add one texel to the left and one texel to the right creating a 3-texel-wide bitImage.
+        // However, if we know that the chart is only 1 texel wide we could align it so that it only touches the footprint of two texels:
+        //      |   |      <- Touches texels 0, 1 and 2.
+        //    |   |        <- Only touches texels 0 and 1.
+        // \   \ / \ /   /
+        //  \   X   X   /
+        //   \ / \ / \ /
+        //    V   V   V
+        //    0   1   2
+        chartImages.image.zeroOutMemory();
+        // Without bilinear filtering the faces are directly rasterized into the image to pack, otherwise into a temporary image which is then expanded.
+        BitImage* chartImage = &chartImages.image;
+        if (Flags::bilinear(options))
+        {
+            scratch.chartImage.resize(chartImage->width(), chartImage->height(), true);
+            chartImage = &scratch.chartImage;
+        }
+        // Rasterize chart faces.
+        const uint32_t faceCount = chart->indices.length / 3;
+        for (uint32_t f = 0; f < faceCount; f++)
+        {
+            Vector2 vertices[3];
+            for (uint32_t v = 0; v < 3; v++)
+                vertices[v] = chart->vertices[chart->indices[f * 3 + v]];
+            raster::drawTriangle(vertices, chartImage);
+        }
+        // Expand chart by pixels sampled by bilinear interpolation.
+        if (Flags::bilinear(options))
+        {
+            findBoundaryEdges(chart, scratch);
+            bilinearExpand(chart, scratch, &chartImages.image);
+        }
+        // Expand chart by padding pixels (dilation).
+        if (Flags::padding(options) > 0)
+            chartImages.image.dilate(Flags::padding(options), scratch.rows);
+        // The rotated image is the transposed final image, which is much faster than also setting the transposed texels while rasterizing.
+        if (Flags::rotateCharts(options))
+            chartImages.image.transposeTo(chartImages.imageRotated);
+    }
+
+    // Finds the edges on the outline of the chart, which are the ones that don't have an opposite edge in another face of the chart. The edges are
+    // matched by the positions of their vertices rather than by their indices, since the faces of meshes loaded from STL files don't share their
+    // vertices. Edges whose faces are on the same side, where the projection of the chart folds, or which have a degenerate face, are also on the
+    // outline.
+    static void findBoundaryEdges(const Chart* chart, RasterizeChartScratch& scratch)
+    {
+        const uint32_t edgeCount = chart->indices.length;
+        const uint32_t slotCount = nextPowerOfTwo(max(2u, edgeCount * 2));
+        scratch.edgeSlots.resize(slotCount);
+        scratch.edgeOpposites.resize(edgeCount);
+        memset(scratch.edgeSlots.data(), 0xff, slotCount * sizeof(uint32_t));
+        memset(scratch.edgeOpposites.data(), 0xff, edgeCount * sizeof(uint32_t));
+        for (uint32_t edge = 0; edge < edgeCount; edge++)
+        {
+            const Vector2& position0 = chart->vertices[chart->indices[meshEdgeIndex0(edge)]];
+            const Vector2& position1 = chart->vertices[chart->indices[meshEdgeIndex1(edge)]];
+            // The hash doesn't depend on the direction of the edge, so that the opposite edge is in the same chain of slots.
+            uint32_t slot = (hash(position0) + hash(position1)) & (slotCount - 1);
+            for (;; slot = (slot + 1) & (slotCount - 1))
+            {
+                const uint32_t other = scratch.edgeSlots[slot];
+                if (other == UINT32_MAX)
                 {
-                    uint32_t s = 0;
-                    for (; s < 8; s++)
-                    {
-                        const int sx = (int)x + xOffsets[s];
-                        const int sy = (int)y + yOffsets[s];
-                        if (sx < 0 || sy < 0 || sx >= (int)source->width() || sy >= (int)source->height())
-                            continue;
-                        if (source->get((uint32_t)sx, (uint32_t)sy))
-                            break;
-                    }
-                    if (s == 8)
-                        continue;
+                    scratch.edgeSlots[slot] = edge;
+                    break;
+                }
+                if (scratch.edgeOpposites[other] != UINT32_MAX)
+                    continue;
+                const Vector2& otherPosition0 = chart->vertices[chart->indices[meshEdgeIndex0(other)]];
+                const Vector2& otherPosition1 = chart->vertices[chart->indices[meshEdgeIndex1(other)]];
+                if (((equalBits(position0, otherPosition1) && equalBits(position1, otherPosition0))
+                     || (equalBits(position0, otherPosition0) && equalBits(position1, otherPosition1)))
+                    && facesOnBothSides(chart, edge, other))
+                {
+                    scratch.edgeOpposites[other] = edge;
+                    scratch.edgeOpposites[edge] = other;
+                    break;
                 }
+            }
+        }
+        scratch.boundaryEdges.clear();
+        for (uint32_t edge = 0; edge < edgeCount; edge++)
+        {
+            if (scratch.edgeOpposites[edge] == UINT32_MAX)
+                scratch.boundaryEdges.push_back(edge);
+        }
+    }
+
+    static bool facesOnBothSides(const Chart* chart, uint32_t edge, uint32_t other)
+    {
+        const Vector2& position0 = chart->vertices[chart->indices[meshEdgeIndex0(edge)]];
+        const Vector2& position1 = chart->vertices[chart->indices[meshEdgeIndex1(edge)]];
+        const float side = triangleArea(position0, position1, chart->vertices[chart->indices[meshEdgeIndex1(meshEdgeIndex1(edge))]]);
+        const float otherSide = triangleArea(position0, position1, chart->vertices[chart->indices[meshEdgeIndex1(meshEdgeIndex1(other))]]);
+        return (side > 0.0f && otherSide < 0.0f) || (side < 0.0f && otherSide > 0.0f);
+    }
+
+    static bool equalBits(const Vector2& a, const Vector2& b)
+    {
+        return memcmp(&a, &b, sizeof(Vector2)) == 0;
+    }
+
+    // Expands scratch.chartImage into dest with the texels that bilinear filtering samples.
+    void bilinearExpand(const Chart* chart, RasterizeChartScratch& scratch, BitImage* dest) const
+    {
+        const BitImage& source = scratch.chartImage;
+        UniformGrid2& boundaryEdgeGrid = scratch.boundaryEdgeGrid;
+        boundaryEdgeGrid.reset(chart->vertices, chart->indices);
+        for (uint32_t i = 0; i < scratch.boundaryEdges.size(); i++)
+            boundaryEdgeGrid.append(scratch.boundaryEdges[i]);
+        // Copy pixels from source. An empty pixel can only be sampled by bilinear interpolation if one of the surrounding pixels is set, so only
+        // these are tested.
+        dest->copyBits(source);
+        source.findNeighbours(scratch.neighbours, scratch.rows);
+        for (uint32_t y = 0; y < source.height(); y++)
+        {
+            const uint64_t* neighboursRow = scratch.neighbours.row(y);
+            for (uint32_t i = 0; i < source.rowStride(); i++)
+            {
+                for (uint64_t bits = neighboursRow[i]; bits != 0; bits &= bits - 1)
                 {
+                    const uint32_t x = i * 64 + (uint32_t)std::countr_zero(bits);
                     // If a 2x2 square centered on the pixels centroid intersects the triangle, this pixel will be sampled by bilinear interpolation.
                     // See "Precomputed Global Illumination in Frostbite (GDC 2018)" page 95
                     const Vector2 centroid((float)x + 0.5f, (float)y + 0.5f);
@@ -3535,32 +4786,16 @@ private:
                     for (uint32_t j = 0; j < 4; j++)
                     {
                         if (boundaryEdgeGrid.intersect(squareVertices[j], squareVertices[(j + 1) % 4], 0.0f))
-                            goto setPixel;
+                        {
+                            dest->set(x, y);
+                            break;
+                        }
                     }
                 }
-                continue;
-            setPixel:
-                dest->set(x, y);
-                if (destRotated)
-                    destRotated->set(y, x);
             }
         }
     }
 
-    struct DrawTriangleCallbackArgs
-    {
-        BitImage *chartBitImage, *chartBitImageRotated;
-    };
-
-    static bool drawTriangleCallback(void* param, int x, int y)
-    {
-        auto args = (DrawTriangleCallbackArgs*)param;
-        args->chartBitImage->set(x, y);
-        if (args->chartBitImageRotated)
-            args->chartBitImageRotated->set(y, x);
-        return true;
-    }
-
     Array<float> m_utilization;
     Array<BitImage*> m_bitImages;
     Array<Chart*> m_charts;
@@ -3569,6 +4804,11 @@ private:
     uint32_t m_height = 0;
     float m_texelsPerUnit = 0.0f;
     KISSRng m_rand;
+    TaskScheduler* m_taskScheduler = nullptr;
+    Array<ChartLocationSlice> m_chartLocationSlices;
+    Array<RandomCandidate> m_randomCandidates;
+    Array<Array<SkylineSegment>*> m_skylines; // One per atlas with the skyline strategy
+    Array<SkylineSegment> m_skylineScratch;
 };
 
 } // namespace pack
@@ -3581,14 +4821,16 @@ struct Context
     internal::TaskScheduler* taskScheduler;
     internal::Array<internal::UvMesh*> uvMeshes;
     internal::Array<internal::UvMeshInstance*> uvMeshInstances;
+    internal::Array<uint64_t> chartImagesArena; // Kept between the calls to PackCharts to avoid reallocating it
+    internal::Arena* arena = nullptr; // With Allocator::Arena, the allocations made for the meshes, which ClearMeshes releases
     bool uvMeshChartsComputed = false;
 };
 
-Atlas* Create()
+Atlas* Create(ThreadPool* threadPool)
 {
     Context* ctx = XA_NEW(Context);
     memset(&ctx->atlas, 0, sizeof(Atlas));
-    ctx->taskScheduler = XA_NEW(internal::TaskScheduler);
+    ctx->taskScheduler = XA_NEW_ARGS(internal::TaskScheduler, threadPool);
     return &ctx->atlas;
 }
 
@@ -3617,17 +4859,8 @@ static void DestroyOutputMeshes(Context* ctx)
     ctx->atlas.meshes = nullptr;
 }
 
-void Destroy(Atlas* atlas)
+static void DestroyUvMeshes(Context* ctx)
 {
-    XA_DEBUG_ASSERT(atlas);
-    Context* ctx = (Context*)atlas;
-    if (atlas->utilization)
-        XA_FREE(atlas->utilization);
-    if (atlas->image)
-        XA_FREE(atlas->image);
-    DestroyOutputMeshes(ctx);
-    ctx->taskScheduler->~TaskScheduler();
-    XA_FREE(ctx->taskScheduler);
     for (uint32_t i = 0; i < ctx->uvMeshes.size(); i++)
     {
         internal::UvMesh* mesh = ctx->uvMeshes[i];
@@ -3645,8 +4878,83 @@ void Destroy(Atlas* atlas)
         mesh->~UvMeshInstance();
         XA_FREE(mesh);
     }
-    ctx->~Context();
-    XA_FREE(ctx);
+    ctx->uvMeshes.clear();
+    ctx->uvMeshInstances.clear();
+    ctx->uvMeshChartsComputed = false;
+}
+
+void Destroy(Atlas* atlas)
+{
+    XA_DEBUG_ASSERT(atlas);
+    Context* ctx = (Context*)atlas;
+    internal::Arena* arena = ctx->arena;
+    {
+        internal::ArenaScope arenaScope(arena);
+        if (atlas->utilization)
+            XA_FREE(atlas->utilization);
+        if (atlas->image)
+            XA_FREE(atlas->image);
+        DestroyOutputMeshes(ctx);
+        ctx->taskScheduler->~TaskScheduler();
+        XA_FREE(ctx->taskScheduler);
+        DestroyUvMeshes(ctx);
+        ctx->~Context();
+        XA_FREE(ctx);
+    }
+    if (arena)
+    {
+        arena->~Arena();
+        XA_FREE(arena);
+    }
+}
+
+void ClearMeshes(Atlas* atlas)
+{
+    XA_DEBUG_ASSERT(atlas);
+    Context* ctx = (Context*)atlas;
+    internal::ArenaScope arenaScope(ctx->arena);
+    if (atlas->utilization)
+        XA_FREE(atlas->utilization);
+    if (atlas->image)
+        XA_FREE(atlas->image);
+    DestroyOutputMeshes(ctx);
+    DestroyUvMeshes(ctx);
+    memset(&ctx->atlas, 0, sizeof(Atlas));
+    if (ctx->arena)
+    {
+        // The arrays of the context keep their memory when they are cleared, which can't be kept if it's in the arena.
+        ctx->uvMeshes.destroy();
+        ctx->uvMeshInstances.destroy();
+        ctx->chartImagesArena.destroy();
+        ctx->arena->reset();
+    }
+}
+
+void SetAllocator(Atlas* atlas, Allocator allocator)
+{
+    XA_DEBUG_ASSERT(atlas);
+    Context* ctx = (Context*)atlas;
+    if (! ctx->uvMeshInstances.isEmpty())
+    {
+        XA_PRINT_WARNING("SetAllocator: The atlas has meshes. Call ClearMeshes first.\n");
+        return;
+    }
+    if (allocator == Allocator::Arena && ! ctx->arena)
+    {
+        ctx->arena = XA_NEW(internal::Arena);
+    }
+    else if (allocator == Allocator::Heap && ctx->arena)
+    {
+        {
+            internal::ArenaScope arenaScope(ctx->arena);
+            ctx->uvMeshes.destroy();
+            ctx->uvMeshInstances.destroy();
+            ctx->chartImagesArena.destroy();
+        }
+        ctx->arena->~Arena();
+        XA_FREE(ctx->arena);
+        ctx->arena = nullptr;
+    }
 }
 
 static uint32_t DecodeIndex(IndexFormat format, const void* indexData, int32_t offset, uint32_t i)
@@ -3666,6 +4974,7 @@ AddMeshError AddUvMesh(Atlas* atlas, const UvMeshDecl& decl)
         return AddMeshError::Error;
     }
     Context* ctx = (Context*)atlas;
+    internal::ArenaScope arenaScope(ctx->arena);
     const bool hasIndices = decl.indexCount > 0;
     const uint32_t indexCount = hasIndices ? decl.indexCount : decl.vertexCount;
     XA_PRINT("Adding UV mesh %d: %u vertices, %u triangles\n", ctx->uvMeshes.size(), decl.vertexCount, indexCount / 3);
@@ -3699,42 +5008,61 @@ AddMeshError AddUvMesh(Atlas* atlas, const UvMeshDecl& decl)
     }
     if (! mesh)
     {
-        // Copy geometry to mesh.
+        // Copy geometry to mesh, or reference it if it is borrowed and already in the layout of the mesh.
         mesh = XA_NEW(internal::UvMesh);
         ctx->uvMeshes.push_back(mesh);
         mesh->decl = decl;
         if (decl.faceMaterialData)
         {
-            mesh->faceMaterials.resize(decl.indexCount / 3);
-            memcpy(mesh->faceMaterials.data(), decl.faceMaterialData, mesh->faceMaterials.size() * sizeof(uint32_t));
+            if (decl.borrowData)
+                mesh->faceMaterials = internal::ConstArrayView<uint32_t>(decl.faceMaterialData, decl.indexCount / 3);
+            else
+            {
+                mesh->faceMaterialsCopy.resize(decl.indexCount / 3);
+                memcpy(mesh->faceMaterialsCopy.data(), decl.faceMaterialData, mesh->faceMaterialsCopy.size() * sizeof(uint32_t));
+                mesh->faceMaterials = mesh->faceMaterialsCopy;
+            }
+        }
+        if (decl.borrowData && hasIndices && decl.indexFormat == IndexFormat::UInt32 && decl.indexOffset == 0)
+            mesh->indices = internal::ConstArrayView<uint32_t>((const uint32_t*)decl.indexData, indexCount);
+        else
+        {
+            mesh->indicesCopy.resize(indexCount);
+            for (uint32_t i = 0; i < indexCount; i++)
+                mesh->indicesCopy[i] = hasIndices ? DecodeIndex(decl.indexFormat, decl.indexData, decl.indexOffset, i) : i;
+            mesh->indices = mesh->indicesCopy;
+        }
+        if (decl.borrowData && decl.vertexStride == sizeof(internal::Vector2))
+            mesh->texcoords = internal::ConstArrayView<internal::Vector2>((const internal::Vector2*)decl.vertexUvData, decl.vertexCount);
+        else
+        {
+            mesh->texcoordsCopy.resize(decl.vertexCount);
+            for (uint32_t i = 0; i < decl.vertexCount; i++)
+                mesh->texcoordsCopy[i] = *((const internal::Vector2*)&((const uint8_t*)decl.vertexUvData)[decl.vertexStride * i]);
+            mesh->texcoords = mesh->texcoordsCopy;
         }
-        mesh->indices.resize(decl.indexCount);
-        for (uint32_t i = 0; i < indexCount; i++)
-            mesh->indices[i] = hasIndices ? DecodeIndex(decl.indexFormat, decl.indexData, decl.indexOffset, i) : i;
-        mesh->texcoords.resize(decl.vertexCount);
-        for (uint32_t i = 0; i < decl.vertexCount; i++)
-            mesh->texcoords[i] = *((const internal::Vector2*)&((const uint8_t*)decl.vertexUvData)[decl.vertexStride * i]);
 
-        mesh->faceIgnore.resize(decl.indexCount / 3);
+        mesh->faceIgnore.resize(indexCount / 3);
         mesh->faceIgnore.zeroOutMemory();
     }
     meshInstance->mesh = mesh;
     return AddMeshError::Success;
 }
 
-void SetCharts(Atlas* atlas, const std::vector<std::vector<size_t>>& grouped_faces)
+uint32_t SetCharts(Atlas* atlas, const uint32_t* chartFaces, const uint32_t* chartOffsets, uint32_t chartCount)
 {
     if (! atlas)
     {
         XA_PRINT_WARNING("ComputeCharts: atlas is null.\n");
-        return;
+        return 0;
     }
     Context* ctx = (Context*)atlas;
+    internal::ArenaScope arenaScope(ctx->arena);
     // AddMeshJoin(atlas);
     if (ctx->uvMeshInstances.isEmpty())
     {
         XA_PRINT_WARNING("ComputeCharts: No meshes. Call AddUvMesh first.\n");
-        return;
+        return 0;
     }
     // Reset atlas state. This function may be called multiple times, or again after PackCharts.
     if (atlas->utilization)
@@ -3744,14 +5072,17 @@ void SetCharts(Atlas* atlas, const std::vector<std::vector<size_t>>& grouped_fac
     DestroyOutputMeshes(ctx);
     memset(&ctx->atlas, 0, sizeof(Atlas));
 
+    uint32_t rejectedFaceCount = 0;
     for (size_t i = 0; i < ctx->uvMeshes.size(); ++i)
     {
         internal::UvMesh* mesh = ctx->uvMeshes[i];
-        internal::segment::SetUvMeshChartsTask task(mesh, grouped_faces);
+        internal::segment::SetUvMeshChartsTask task(mesh, chartFaces, chartOffsets, chartCount);
         task.run();
+        rejectedFaceCount += task.rejectedFaceCount();
     }
 
     ctx->uvMeshChartsComputed = true;
+    return rejectedFaceCount;
 }
 
 void PackCharts(Atlas* atlas, PackOptions packOptions)
@@ -3778,6 +5109,7 @@ void PackCharts(Atlas* atlas, PackOptions packOptions)
         XA_PRINT_WARNING("PackCharts: PackOptions::texelsPerUnit is negative.\n");
         packOptions.texelsPerUnit = 0.0f;
     }
+    internal::ArenaScope arenaScope(ctx->arena);
     // Cleanup atlas.
     DestroyOutputMeshes(ctx);
     if (atlas->utilization)
@@ -3795,7 +5127,7 @@ void PackCharts(Atlas* atlas, PackOptions packOptions)
     internal::pack::Atlas packAtlas;
     for (uint32_t i = 0; i < ctx->uvMeshInstances.size(); i++)
         packAtlas.addUvMeshCharts(ctx->uvMeshInstances[i]);
-    if (! packAtlas.packCharts(packOptions))
+    if (! packAtlas.packCharts(packOptions, ctx->taskScheduler, ctx->chartImagesArena))
         return;
     // Populate atlas object with pack results.
     atlas->atlasCount = packAtlas.getNumAtlases();
@@ -3822,7 +5154,7 @@ void PackCharts(Atlas* atlas, PackOptions packOptions)
         const internal::UvMeshInstance* mesh = ctx->uvMeshInstances[m];
         // Alloc arrays.
         outputMesh.vertexCount = mesh->texcoords.size();
-        outputMesh.indexCount = mesh->mesh->indices.size();
+        outputMesh.indexCount = mesh->mesh->indices.length;
         outputMesh.chartCount = mesh->mesh->charts.size();
         outputMesh.vertexArray = XA_ALLOC_ARRAY(PlacedVertex, outputMesh.vertexCount);
         outputMesh.indexArray = XA_ALLOC_ARRAY(uint32_t, outputMesh.indexCount);
@@ -3851,7 +5183,7 @@ void PackCharts(Atlas* atlas, PackOptions packOptions)
             }
         }
         // Indices.
-        memcpy(outputMesh.indexArray, mesh->mesh->indices.data(), mesh->mesh->indices.size() * sizeof(uint32_t));
+        memcpy(outputMesh.indexArray, mesh->mesh->indices.data, mesh->mesh->indices.length * sizeof(uint32_t));
         // Charts.
         for (uint32_t c = 0; c < mesh->mesh->charts.size(); c++)
         {
@@ -3859,7 +5191,7 @@ void PackCharts(Atlas* atlas, PackOptions packOptions)
             const internal::pack::Chart* chart = packAtlas.getChart(chartIndex);
             XA_DEBUG_ASSERT(chart->atlasIndex >= 0);
             outputChart->atlasIndex = (uint32_t)chart->atlasIndex;
-            outputChart->faceCount = chart->faces.size();
+            outputChart->faceCount = chart->faces.length;
             outputChart->faceArray = XA_ALLOC_ARRAY(uint32_t, outputChart->faceCount);
             outputChart->material = chart->material;
             for (uint32_t f = 0; f < outputChart->faceCount; f++)
@@ -0,0 +1,124 @@
+// (c) 2025, UltiMaker -- see LICENCE for details
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "Charts.h"
+#include "Point2F.h"
+#include "ThreadPool.h"
+#include "mesh_generator.h"
+#include "unwrap_stages.h"
+#include "xatlas.h"
+
+/*
+ * Checks that packing the charts gives the same atlas whatever the number of threads, since the searches of chart locations are split over the
+ * threads but should reduce to the result of a serial search.
+ */
+namespace
+{
+
+struct PackResult
+{
+    uint32_t width{ 0 };
+    uint32_t height{ 0 };
+    std::vector<float> uv_coords; // Of the output vertices, in their order
+    std::vector<int32_t> charts; // Of the output vertices, in their order
+
+    bool operator==(const PackResult& other) const = default;
+};
+
+PackResult pack(
+    const mesh_generator::GeneratedMesh& mesh,
+    const Charts& charts,
+    const std::vector<Point2F>& uv_coords,
+    const xatlas::PackOptions& options,
+    ThreadPool& thread_pool)
+{
+    xatlas::Atlas* atlas = xatlas::Create(&thread_pool);
+
+    xatlas::UvMeshDecl mesh_decl;
+    mesh_decl.vertexUvData = uv_coords.data();
+    mesh_decl.indexData = mesh.faces.data();
+    mesh_decl.vertexCount = mesh.vertices.size();
+    mesh_decl.vertexStride = sizeof(Point2F);
+    mesh_decl.indexCount = mesh.faces.size() * 3;
+    mesh_decl.indexFormat = xatlas::IndexFormat::UInt32;
+    xatlas::AddUvMesh(atlas, mesh_decl);
+    xatlas::SetCharts(atlas, charts.faces.data(), charts.offsets.data(), charts.size());
+    xatlas::PackCharts(atlas, options);
+
+    PackResult result{ .width = atlas->width, .height = atlas->height };
+    const xatlas::Mesh& output_mesh = *atlas->meshes;
+    for (uint32_t index = 0; index < output_mesh.vertexCount; ++index)
+    {
+        const xatlas::PlacedVertex& vertex = output_mesh.vertexArray[index];
+        result.uv_coords.push_back(vertex.uv[0]);
+        result.uv_coords.push_back(vertex.uv[1]);
+        result.charts.push_back(vertex.chartIndex);
+    }
+
+    xatlas::Destroy(atlas);
+    return result;
+}
+
+} // namespace
+
+int main()
+{
+    ThreadPool serial_thread_pool(1);
+    ThreadPool parallel_thread_pool(8);
+    UnwrapScratch scratch;
+    size_t failures_count = 0;
+
+    for (const mesh_generator::Shape shape : { mesh_generator::Shape::Sphere, mesh_generator::Shape::Terrain })
+    {
+        for (uint32_t seed = 0; seed < 5; ++seed)
+        {
+            const mesh_generator::GeneratedMesh mesh = mesh_generator::generateMesh(
+                mesh_generator::GeneratorOptions{ .shape = shape, .faces_count = 8'000, .seed = seed, .soup = true });
+            std::vector<Point2F> uv_coords(mesh.vertices.size());
+            Charts charts = makeCharts(mesh.vertices, mesh.faces, uv_coords, 0, serial_thread_pool, scratch);
+            const std::vector<Face>& welded_faces = groupSimilarVertices(mesh.faces, mesh.vertices, 0.0f, serial_thread_pool, scratch);
+            charts = splitNonLinkedFacesCharts(charts, welded_faces, serial_thread_pool);
+
+            for (const uint32_t padding : { 0, 1 })
+            {
+                for (const bool bilinear : { false, true })
+                {
+                    for (const xatlas::PackStrategy strategy : { xatlas::PackStrategy::Bitmap, xatlas::PackStrategy::Skyline })
+                    {
+                        const xatlas::PackOptions options{ .padding = padding, .bilinear = bilinear, .blockAlign = true, .strategy = strategy };
+                        const PackResult serial_result = pack(mesh, charts, uv_coords, options, serial_thread_pool);
+                        const PackResult parallel_result = pack(mesh, charts, uv_coords, options, parallel_thread_pool);
+                        if (serial_result != parallel_result)
+                        {
+                            spdlog::error(
+                                "Shape {} seed {} padding {} bilinear {} strategy {}: packed to {}x{} with 1 thread but {}x{} with {} threads",
+                                static_cast<int>(shape),
+                                seed,
+                                padding,
+                                bilinear,
+                                static_cast<int>(strategy),
+                                serial_result.width,
+                                serial_result.height,
+                                parallel_result.width,
+                                parallel_result.height,
+                                parallel_thread_pool.threadCount());
+                            ++failures_count;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (failures_count > 0)
+    {
+        spdlog::error("{} packings depend on the number of threads", failures_count);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}